@@ -0,0 +1,200 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+
+#include "analog.h"
+
+#if ADC_NCHAN > 0
+
+#define ANALOG_BLOCK (ADC_NCHAN * ANALOG_DECIMATION) // interleaved samples per DMA block
+
+static uint16_t adcBuf[2][ANALOG_BLOCK]; // ping-pong buffers
+static int dmaChan[2];
+static uint32_t tareCount;
+static volatile uint32_t onsets;
+#if ANALOG_NCHAN > 0
+static int32_t level[ANALOG_NCHAN];      // low-pass filtered level, 4 fractional bits
+static int32_t baseline[ANALOG_NCHAN];   // zero-force level in ADC counts
+static volatile int32_t force[ANALOG_NCHAN];
+static volatile bool axesUpdate;
+#endif
+
+
+
+//--------------------------------------------------------------------+
+// Filter and decimate one block of round-robin samples
+//--------------------------------------------------------------------+
+static void process_block(const uint16_t* buf)
+{
+  bool tared = tareCount >= ANALOG_TARE_BLOCKS;
+
+#if VOICEKEY
+  // The microphone is the last channel of the round robin
+  voicekey_process(buf + ANALOG_NCHAN, ANALOG_DECIMATION, ADC_NCHAN, tared);
+  if(voicekey_onset()) {
+    onsets |= 1u << VOICEKEY_ONSET_BIT;
+  } else {
+    onsets &= ~(1u << VOICEKEY_ONSET_BIT);
+  }
+#endif
+
+#if ANALOG_NCHAN > 0
+  uint32_t sum[ANALOG_NCHAN] = { 0 };
+
+  // Boxcar (moving sum) decimation filter. Samples are interleaved ch0, ch1, ..
+  for(int i = 0; i < ANALOG_BLOCK; i += ADC_NCHAN) {
+    for(int k = 0; k < ANALOG_NCHAN; k++) {
+      sum[k] += buf[i + k] & 0xFFF;
+    }
+  }
+
+  for(int k = 0; k < ANALOG_NCHAN; k++) {
+    int32_t mean = (sum[k] << 4) / ANALOG_DECIMATION;
+    level[k] += (mean - level[k]) >> ANALOG_SMOOTH;
+
+    if(!tared) {
+      baseline[k] += mean >> 4;
+      continue;
+    }
+
+    int32_t f = (level[k] >> 4) - baseline[k];
+    if(f < 0) f = 0;
+    force[k] = f;
+
+    // Onset detection with hysteresis on the unsmoothed block mean,
+    // the IIR low-pass would delay the onset by several blocks.
+    int32_t fBlock = (mean >> 4) - baseline[k];
+    if(fBlock > ANALOG_ONSET_THRESHOLD) {
+      onsets |= 1u << k;
+    } else if(fBlock < ANALOG_ONSET_THRESHOLD - ANALOG_ONSET_HYSTERESIS) {
+      onsets &= ~(1u << k);
+    }
+  }
+
+  if(tared) axesUpdate = true;
+#endif
+
+  if(!tared && ++tareCount == ANALOG_TARE_BLOCKS) {
+#if ANALOG_NCHAN > 0
+    for(int k = 0; k < ANALOG_NCHAN; k++) baseline[k] /= ANALOG_TARE_BLOCKS;
+#endif
+  }
+}
+
+
+
+//--------------------------------------------------------------------+
+// DMA ISR, invoked when one of the ping-pong buffers is full
+//--------------------------------------------------------------------+
+static void dma_handler(void)
+{
+  for(int i = 0; i < 2; i++) {
+    if(dma_channel_get_irq1_status(dmaChan[i])) {
+      dma_channel_acknowledge_irq1(dmaChan[i]);
+      // The other channel is running now. Re-arm this one for the next chain trigger.
+      dma_channel_set_write_addr(dmaChan[i], adcBuf[i], false);
+      process_block(adcBuf[i]);
+    }
+  }
+}
+
+
+
+//--------------------------------------------------------------------+
+// Start free-running ADC conversions into the ping-pong buffers
+//--------------------------------------------------------------------+
+void analog_init(void)
+{
+  adc_init();
+  for(int k = 0; k < ADC_NCHAN; k++) {
+    adc_gpio_init(FIRST_GPIO_ADC + k);
+  }
+  adc_select_input(0);
+  adc_set_round_robin((1u << ADC_NCHAN) - 1);
+  adc_fifo_setup(true, true, 1, false, false); // enable fifo and DREQ, no error bit, 12 bit samples
+  adc_set_clkdiv(48000000.f / (ANALOG_FS * ADC_NCHAN) - 1.f); // 48MHz ADC clock, one conversion per clkdiv+1 cycles
+
+  dmaChan[0] = dma_claim_unused_channel(true);
+  dmaChan[1] = dma_claim_unused_channel(true);
+  for(int i = 0; i < 2; i++) {
+    dma_channel_config c = dma_channel_get_default_config(dmaChan[i]);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, DREQ_ADC);
+    channel_config_set_chain_to(&c, dmaChan[1 - i]);
+    dma_channel_configure(dmaChan[i], &c, adcBuf[i], &adc_hw->fifo, ANALOG_BLOCK, false);
+    dma_channel_set_irq1_enabled(dmaChan[i], true);
+  }
+  irq_add_shared_handler(DMA_IRQ_1, dma_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(DMA_IRQ_1, true);
+
+  dma_channel_start(dmaChan[0]);
+  adc_run(true);
+}
+
+
+
+//--------------------------------------------------------------------+
+// Bitmask of the channels that are above the onset threshold,
+// the voice key at VOICEKEY_ONSET_BIT
+//--------------------------------------------------------------------+
+uint32_t analog_onsets(void)
+{
+  return onsets;
+}
+
+
+
+//--------------------------------------------------------------------+
+// Scale the force levels to joystick axes (0..127)
+// Returns true when a new block was processed since the last call.
+//--------------------------------------------------------------------+
+bool analog_read(int8_t* axes)
+{
+#if ANALOG_NCHAN > 0
+  if(!axesUpdate) return false;
+  axesUpdate = false;
+
+  for(int k = 0; k < ANALOG_NCHAN; k++) {
+    axes[k] = (int8_t) (force[k] >> 5); // 12 bit to 7 bit
+  }
+  return true;
+#else
+  (void) axes;
+  return false;
+#endif
+}
+
+#else
+
+void analog_init(void) {}
+uint32_t analog_onsets(void) { return 0; }
+bool analog_read(int8_t* axes) { (void) axes; return false; }
+
+#endif
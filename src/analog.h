@@ -0,0 +1,57 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef ANALOG_H_
+#define ANALOG_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "voicekey.h"
+
+// Number of analog response channels (force/pressure sensors) on GP26-GP28.
+// 0 = disabled, max = 3. Can be overridden from CMakeLists.txt.
+#ifndef ANALOG_NCHAN
+#define ANALOG_NCHAN 0
+#endif
+
+#define ADC_NCHAN (ANALOG_NCHAN + VOICEKEY) // ADC inputs in the round robin, force channels first
+#if ADC_NCHAN > 3
+#error "ANALOG_NCHAN + VOICEKEY exceeds the ADC inputs GP26-GP28"
+#endif
+
+#define FIRST_GPIO_ADC 26
+#define ANALOG_FS (VOICEKEY ? VOICEKEY_FS : 8000) // ADC sample rate per channel in Hz
+#define ANALOG_DECIMATION (ANALOG_FS / 1000)      // samples per channel in one 1 ms DMA block
+#define ANALOG_SMOOTH 2             // first order IIR low-pass of the force axes after decimation, alpha = 1/2^ANALOG_SMOOTH
+#define ANALOG_TARE_BLOCKS 64       // number of blocks averaged at power-up for the zero-force baseline
+#define ANALOG_ONSET_THRESHOLD 200  // force onset level in ADC counts above baseline (12-bit ADC)
+#define ANALOG_ONSET_HYSTERESIS 50  // release when below threshold minus hysteresis
+
+void analog_init(void);
+uint32_t analog_onsets(void);
+bool analog_read(int8_t* axes);
+
+#endif /* ANALOG_H_ */
@@ -0,0 +1,328 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
+#include "pico/time.h"
+
+#include "tusb.h"
+#include "usb_descriptors.h"
+#include "capture.h"
+
+#if CAPTURE
+
+#include "capture.pio.h"
+
+/*
+ * Raw high-rate input capture. A PIO state machine samples GP0-GP7, the
+ * undebounced pin levels, and two chained DMA channels move the samples
+ * into a pool of CAPTURE_NBUF blocks, so the sampling never waits for the
+ * CPU. The DMA ISR only re-arms the channel. The full blocks are run-length
+ * encoded into (state, duration) words by capture_task():
+ *
+ *   word[7:0]  = pin levels
+ *   word[31:8] = duration in samples
+ *
+ * The words are streamed over the CDC interface, so the bandwidth scales
+ * with the input activity rather than the sample rate. When the host does
+ * not keep up, runs are dropped, counted, and a CAPTURE_GAP word marks the
+ * spot in the stream. Blocks that are overwritten before they are encoded
+ * are counted as overruns and marked the same way.
+ */
+
+static PIO pio = pio0;
+static uint sm;
+static int dmaChan[2];
+static uint32_t buf[CAPTURE_NBUF][CAPTURE_BLOCK];
+static volatile uint32_t blocksFilled;  // block n is written to buf[n % CAPTURE_NBUF]
+static uint32_t blocksEncoded;
+static volatile bool running;
+static uint32_t rate = CAPTURE_RATE;
+static uint64_t startTime;
+
+static uint8_t runState;
+static uint32_t runLen;
+static bool gap;
+static uint32_t ring[CAPTURE_RING_LEN];
+static uint32_t ringHead, ringTail;
+static uint32_t runs, dropped, sent, overruns;
+
+
+
+//--------------------------------------------------------------------+
+// Run-length encoder, producer side of the ring
+//--------------------------------------------------------------------+
+static bool ring_put(uint32_t word)
+{
+  uint32_t next = (ringHead + 1) & (CAPTURE_RING_LEN - 1);
+
+  if(next == ringTail) return false;
+  ring[ringHead] = word;
+  ringHead = next;
+  return true;
+}
+
+static void emit_run(uint8_t state, uint32_t len)
+{
+  runs++;
+  if(gap) {
+    if(!ring_put(CAPTURE_GAP)) {
+      dropped++;
+      return;
+    }
+    gap = false;
+  }
+  if(!ring_put((len << 8) | state)) {
+    dropped++;
+    gap = true;
+  }
+}
+
+static void encode(const uint8_t* sample, uint32_t n)
+{
+  for(uint32_t i = 0; i < n; i++) {
+    if(sample[i] == runState && runLen < CAPTURE_RUN_MAX) {
+      runLen++;
+    } else {
+      if(runLen) emit_run(runState, runLen);
+      runState = sample[i];
+      runLen = 1;
+    }
+  }
+}
+
+// Samples were lost, close the current run and mark the gap
+static void overrun(uint32_t blocks)
+{
+  overruns += blocks;
+  if(runLen) emit_run(runState, runLen);
+  runLen = 0;
+  gap = true;
+}
+
+
+
+//--------------------------------------------------------------------+
+// Encode the blocks filled since the last call. A block is overwritten
+// by the DMA CAPTURE_NBUF - 2 blocks after it was filled.
+//--------------------------------------------------------------------+
+static void encode_pending(void)
+{
+  // The state machine stalls when both DMA channels are late
+  uint32_t stall = 1u << (PIO_FDEBUG_RXSTALL_LSB + sm);
+  if(pio->fdebug & stall) {
+    pio->fdebug = stall; // write 1 to clear
+    overrun(0);
+  }
+
+  while(blocksEncoded != blocksFilled) {
+    uint32_t behind = blocksFilled - blocksEncoded;
+    if(behind > CAPTURE_NBUF - 2) {
+      overrun(behind - (CAPTURE_NBUF - 2));
+      blocksEncoded = blocksFilled - (CAPTURE_NBUF - 2);
+    }
+    encode((const uint8_t*) buf[blocksEncoded % CAPTURE_NBUF], CAPTURE_BLOCK * 4);
+    blocksEncoded++;
+    // The block may have been overwritten while it was encoded
+    if(blocksFilled - blocksEncoded + 1 > CAPTURE_NBUF - 2) overrun(1);
+  }
+}
+
+
+
+//--------------------------------------------------------------------+
+// DMA ISR, re-arm the channel that finished. The other channel is running.
+//--------------------------------------------------------------------+
+static void dma_handler(void)
+{
+  // Blocks complete in order, alternating between the channels
+  for(int n = 0; n < 2; n++) {
+    int i = blocksFilled & 1;
+    if(!dma_channel_get_irq1_status(dmaChan[i])) return;
+    dma_channel_acknowledge_irq1(dmaChan[i]);
+    dma_channel_set_write_addr(dmaChan[i], buf[(blocksFilled + 2) % CAPTURE_NBUF], false);
+    blocksFilled++;
+  }
+}
+
+
+
+void capture_init(uint32_t firstGpioIn)
+{
+  uint offset = pio_add_program(pio, &capture_program);
+  sm = pio_claim_unused_sm(pio, true);
+  capture_program_init(pio, sm, offset, firstGpioIn, (float) clock_get_hz(clk_sys) / rate);
+
+  dmaChan[0] = dma_claim_unused_channel(true);
+  dmaChan[1] = dma_claim_unused_channel(true);
+  for(int i = 0; i < 2; i++) {
+    dma_channel_config c = dma_channel_get_default_config(dmaChan[i]);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, false);
+    channel_config_set_write_increment(&c, true);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, false));
+    channel_config_set_chain_to(&c, dmaChan[1 - i]);
+    dma_channel_configure(dmaChan[i], &c, buf[i], &pio->rxf[sm], CAPTURE_BLOCK, false);
+    dma_channel_set_irq1_enabled(dmaChan[i], true);
+  }
+  irq_add_shared_handler(DMA_IRQ_1, dma_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+  irq_set_enabled(DMA_IRQ_1, true);
+}
+
+
+
+static void capture_start(uint32_t newRate)
+{
+  if(newRate > 0) {
+    if(newRate < CAPTURE_RATE_MIN) newRate = CAPTURE_RATE_MIN;
+    if(newRate > CAPTURE_RATE_MAX) newRate = CAPTURE_RATE_MAX;
+    rate = newRate;
+  }
+
+  runState = 0;
+  runLen = 0;
+  gap = false;
+  runs = dropped = sent = overruns = 0;
+  ringTail = ringHead;
+  blocksFilled = blocksEncoded = 0;
+
+  pio_sm_set_clkdiv(pio, sm, (float) clock_get_hz(clk_sys) / rate);
+  pio_sm_clear_fifos(pio, sm);
+  pio_sm_restart(pio, sm);
+  pio->fdebug = 1u << (PIO_FDEBUG_RXSTALL_LSB + sm);
+  for(int i = 0; i < 2; i++) {
+    dma_channel_set_write_addr(dmaChan[i], buf[i], false);
+    dma_channel_set_trans_count(dmaChan[i], CAPTURE_BLOCK, false);
+  }
+  dma_channel_start(dmaChan[0]);
+
+  startTime = time_us_64();
+  pio_sm_set_enabled(pio, sm, true);
+  running = true;
+}
+
+
+
+static void capture_stop(void)
+{
+  if(!running) return;
+  pio_sm_set_enabled(pio, sm, false);
+  running = false;
+
+  busy_wait_us(2); // let the DMA drain the FIFO
+
+  // Count the blocks that completed meanwhile, then abort. An abort can
+  // raise the completion IRQ, keep it masked meanwhile.
+  uint32_t irq = save_and_disable_interrupts();
+  dma_handler();
+  int partial = blocksFilled & 1;
+  for(int i = 0; i < 2; i++) {
+    dma_channel_set_irq1_enabled(dmaChan[i], false);
+    dma_channel_abort(dmaChan[i]);
+    dma_channel_acknowledge_irq1(dmaChan[i]);
+    dma_channel_set_irq1_enabled(dmaChan[i], true);
+  }
+  uint32_t words = CAPTURE_BLOCK - dma_channel_hw_addr(dmaChan[partial])->transfer_count;
+  restore_interrupts(irq);
+
+  // Encode the full blocks, the partial block, the samples left in the FIFO and the last run.
+  encode_pending();
+  encode((const uint8_t*) buf[blocksFilled % CAPTURE_NBUF], words * 4);
+  while(!pio_sm_is_rx_fifo_empty(pio, sm)) {
+    uint32_t w = pio_sm_get(pio, sm);
+    encode((const uint8_t*) &w, 4);
+  }
+  if(runLen) emit_run(runState, runLen);
+  runLen = 0;
+}
+
+
+
+//--------------------------------------------------------------------+
+// Encode the new blocks and stream the runs, consumer side of the ring
+//--------------------------------------------------------------------+
+void capture_task(void)
+{
+  bool written = false;
+
+  if(running) encode_pending();
+  if(!tud_cdc_connected()) return;
+
+  while(ringTail != ringHead && tud_cdc_write_available() >= sizeof(uint32_t)) {
+    tud_cdc_write(&ring[ringTail], sizeof(uint32_t));
+    ringTail = (ringTail + 1) & (CAPTURE_RING_LEN - 1);
+    sent++;
+    written = true;
+  }
+  if(written) tud_cdc_write_flush();
+}
+
+
+
+//--------------------------------------------------------------------+
+// Feature report
+//--------------------------------------------------------------------+
+void capture_set_report(uint8_t const* buffer, uint16_t bufsize)
+{
+  ez_capture_report_t report;
+
+  if(bufsize < sizeof(report)) return;
+  memcpy(&report, buffer, sizeof(report));
+
+  // Runs in the USB task, like capture_task()
+  capture_stop();
+  if(report.command == CAPTURE_CMD_START) capture_start(report.rate);
+}
+
+uint16_t capture_get_report(uint8_t* buffer, uint16_t reqlen)
+{
+  ez_capture_report_t report = {
+    .command = running,
+    .rate = rate,
+    .startTime = startTime,
+    .runs = runs,
+    .dropped = dropped,
+    .sent = sent,
+    .pending = (ringHead - ringTail) & (CAPTURE_RING_LEN - 1),
+    .overruns = overruns
+  };
+
+  if(reqlen < sizeof(report)) return 0;
+  memcpy(buffer, &report, sizeof(report));
+  return sizeof(report);
+}
+
+#else
+
+void capture_init(uint32_t firstGpioIn) { (void) firstGpioIn; }
+void capture_task(void) {}
+void capture_set_report(uint8_t const* buffer, uint16_t bufsize) { (void) buffer; (void) bufsize; }
+uint16_t capture_get_report(uint8_t* buffer, uint16_t reqlen) { (void) buffer; (void) reqlen; return 0; }
+
+#endif
@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Raw input capture of GP0-GP7, streamed over an extra CDC (serial) interface.
+// 0 = disabled, 1 = enabled. Can be overridden from CMakeLists.txt.
+#ifndef CAPTURE
+#define CAPTURE 0
+#endif
+
+#define CAPTURE_RATE 100000       // default sample rate in Hz
+#define CAPTURE_RATE_MIN 2000     // the PIO clock divider is 16 bit
+#define CAPTURE_RATE_MAX 500000
+#define CAPTURE_BLOCK 256         // words of four samples per DMA block
+#define CAPTURE_NBUF 8            // DMA blocks, the encoder may lag CAPTURE_NBUF - 2 blocks
+#define CAPTURE_RING_LEN 1024     // run-length words waiting for the CDC, power of 2
+#define CAPTURE_RUN_MAX 0xFFFFFF  // longest run in one word, in samples
+#define CAPTURE_GAP 0             // stream word that marks dropped runs
+
+// Commands of the capture report
+enum {
+  CAPTURE_CMD_STOP = 0,
+  CAPTURE_CMD_START,
+};
+
+void capture_init(uint32_t firstGpioIn);
+void capture_task(void);
+void capture_set_report(uint8_t const* buffer, uint16_t bufsize);
+uint16_t capture_get_report(uint8_t* buffer, uint16_t reqlen);
+
+#endif /* CAPTURE_H_ */
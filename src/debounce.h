@@ -0,0 +1,101 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef DEBOUNCE_H_
+#define DEBOUNCE_H_
+
+/*
+ * Binary FIR debounce filter according Steven Pigeon:
+ * https://hbfs.wordpress.com/2008/08/20/debouncing-using-binary-finite-impulse-reponse-filter/
+ *
+ * A filter spec is a triple: window length (1-8 samples), threshold, hysteresis.
+ * The output switches on when at least <threshold> samples in the window are one,
+ * and switches off again when less than <threshold - hysteresis> samples are one.
+ *
+ * The decision table is generated at compile time. It is indexed with
+ * (output << 8) | window, so every channel costs one table lookup per sample
+ * regardless of its spec.
+ */
+
+// Filter specs: window length, threshold, hysteresis
+#define DEBOUNCE_SWITCH   4, 2, 0   // microswitches, 2 out of the last 4 samples. Same as the original 5-bit table
+#define DEBOUNCE_BUTTON   6, 4, 1   // tactile push buttons with longer bounce
+#define DEBOUNCE_PEDAL    8, 6, 3   // foot pedals and other heavy contacts
+
+// Filter spec per input channel GP0-GP7
+#ifndef DEBOUNCE_CH0
+#define DEBOUNCE_CH0 DEBOUNCE_SWITCH
+#endif
+#ifndef DEBOUNCE_CH1
+#define DEBOUNCE_CH1 DEBOUNCE_SWITCH
+#endif
+#ifndef DEBOUNCE_CH2
+#define DEBOUNCE_CH2 DEBOUNCE_SWITCH
+#endif
+#ifndef DEBOUNCE_CH3
+#define DEBOUNCE_CH3 DEBOUNCE_SWITCH
+#endif
+#ifndef DEBOUNCE_CH4
+#define DEBOUNCE_CH4 DEBOUNCE_SWITCH
+#endif
+#ifndef DEBOUNCE_CH5
+#define DEBOUNCE_CH5 DEBOUNCE_SWITCH
+#endif
+#ifndef DEBOUNCE_CH6
+#define DEBOUNCE_CH6 DEBOUNCE_SWITCH
+#endif
+#ifndef DEBOUNCE_CH7
+#define DEBOUNCE_CH7 DEBOUNCE_SWITCH
+#endif
+
+#define DEBOUNCE_TABLE_SIZE 512
+
+// DEBOUNCE_TABLE(spec) expands to the initializer of a DEBOUNCE_TABLE_SIZE decision table.
+// DEBOUNCE_MASK(spec) expands to the window bit mask.
+#define DEBOUNCE_TABLE(spec) DB_TABLE_(spec)
+#define DEBOUNCE_MASK(spec) DB_MASK_(spec)
+
+//--------------------------------------------------------------------+
+// Table generator
+//--------------------------------------------------------------------+
+#define DB_TABLE_(w, t, h) { DB_REP512(w, t, h, 0) }
+#define DB_MASK_(w, t, h) ((1u << (w)) - 1)
+
+#define DB_POP(x) ( ((x) & 1) + (((x) >> 1) & 1) + (((x) >> 2) & 1) + (((x) >> 3) & 1) + \
+                    (((x) >> 4) & 1) + (((x) >> 5) & 1) + (((x) >> 6) & 1) + (((x) >> 7) & 1) )
+#define DB_ENTRY(w, t, h, i) \
+  (DB_POP((i) & ((1u << (w)) - 1)) >= (((i) >> 8) ? (t) - (h) : (t))),
+
+#define DB_REP4(w, t, h, i)   DB_ENTRY(w, t, h, (i))      DB_ENTRY(w, t, h, (i) + 1) \
+                              DB_ENTRY(w, t, h, (i) + 2)  DB_ENTRY(w, t, h, (i) + 3)
+#define DB_REP16(w, t, h, i)  DB_REP4(w, t, h, (i))       DB_REP4(w, t, h, (i) + 4) \
+                              DB_REP4(w, t, h, (i) + 8)   DB_REP4(w, t, h, (i) + 12)
+#define DB_REP64(w, t, h, i)  DB_REP16(w, t, h, (i))      DB_REP16(w, t, h, (i) + 16) \
+                              DB_REP16(w, t, h, (i) + 32) DB_REP16(w, t, h, (i) + 48)
+#define DB_REP256(w, t, h, i) DB_REP64(w, t, h, (i))      DB_REP64(w, t, h, (i) + 64) \
+                              DB_REP64(w, t, h, (i) + 128) DB_REP64(w, t, h, (i) + 192)
+#define DB_REP512(w, t, h, i) DB_REP256(w, t, h, (i))     DB_REP256(w, t, h, (i) + 256)
+
+#endif /* DEBOUNCE_H_ */
@@ -0,0 +1,139 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "hardware/sync.h"
+
+#include "tusb.h"
+#include "usb_descriptors.h"
+#include "health.h"
+
+/*
+ * Contact health telemetry per input channel. Counts the presses, the raw
+ * transitions and the debounced transitions. The difference are the raw
+ * transitions rejected by the debounce filter. Raw edges that follow each
+ * other within HEALTH_STABLE scan periods form a bounce burst, of which the
+ * duration is measured. A worn contact shows up as a growing number of
+ * rejected edges and longer bursts.
+ */
+
+typedef struct {
+  uint32_t presses;
+  uint32_t rawEdges;
+  uint32_t edges;       // debounced edges
+  uint32_t bounces;     // bursts with more than one raw edge
+  uint32_t bounceSum;   // total burst duration in scan periods
+  uint32_t bounceMax;
+  uint16_t stable;      // scan periods since the last raw edge
+  uint32_t burst;       // duration of the current burst, chatter can last for seconds
+  uint32_t burstEdges;  // raw edges in the current burst
+} healthChannel;
+
+static healthChannel chan[8];
+static uint32_t lastRaw, lastDebounced;
+static uint8_t selected;  // channel returned by the feature report
+
+
+
+//--------------------------------------------------------------------+
+// Update the counters, called every scan period from the timer ISR.
+// Fixed cost per channel.
+//--------------------------------------------------------------------+
+void health_scan(uint32_t raw, uint32_t debounced)
+{
+  uint32_t rawEdge = raw ^ lastRaw;
+  uint32_t edge = debounced ^ lastDebounced;
+  lastRaw = raw;
+  lastDebounced = debounced;
+
+  for(int k = 0; k < 8; k++) {
+    healthChannel* c = &chan[k];
+    uint32_t re = (rawEdge >> k) & 1;
+
+    c->rawEdges += re;
+    c->edges += (edge >> k) & 1;
+    c->presses += (edge & debounced) >> k & 1;
+
+    if(re) {
+      if(c->stable >= HEALTH_STABLE) { // first edge of a new burst
+        c->burst = 0;
+        c->burstEdges = 1;
+      } else {
+        c->burst += c->stable + 1;
+        c->burstEdges++;
+      }
+      c->stable = 0;
+    } else if(c->stable < HEALTH_STABLE) {
+      if(++c->stable == HEALTH_STABLE && c->burstEdges > 1) { // end of a bouncing burst
+        c->bounces++;
+        c->bounceSum += c->burst;
+        if(c->burst > c->bounceMax) c->bounceMax = c->burst;
+      }
+    }
+  }
+}
+
+
+
+//--------------------------------------------------------------------+
+// Feature report. SET selects the channel and optionally clears its counters,
+// GET returns the selected channel.
+//--------------------------------------------------------------------+
+void health_set_report(uint8_t const* buffer, uint16_t bufsize)
+{
+  if(bufsize < 2) return;
+  selected = buffer[0] & 7;
+
+  if(buffer[1] & HEALTH_CMD_RESET) {
+    uint32_t irq = save_and_disable_interrupts();
+    uint16_t stable = chan[selected].stable;
+    memset(&chan[selected], 0, sizeof(healthChannel));
+    chan[selected].stable = stable;
+    restore_interrupts(irq);
+  }
+}
+
+uint16_t health_get_report(uint8_t* buffer, uint16_t reqlen, uint32_t scanPeriod)
+{
+  // Copy in one piece, the scan ISR updates the counters
+  uint32_t irq = save_and_disable_interrupts();
+  healthChannel c = chan[selected];
+  restore_interrupts(irq);
+
+  ez_health_report_t report = {
+    .channel = selected,
+    .command = 0,
+    .presses = c.presses,
+    .rawEdges = c.rawEdges,
+    .rejected = c.rawEdges - c.edges,
+    .bounces = c.bounces,
+    .bounceMean = c.bounces ? (uint32_t) ((uint64_t) c.bounceSum * scanPeriod / c.bounces) : 0,
+    .bounceMax = c.bounceMax * scanPeriod
+  };
+
+  if(reqlen < sizeof(report)) return 0;
+  memcpy(buffer, &report, sizeof(report));
+  return sizeof(report);
+}
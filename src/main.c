@@ -57,16 +57,29 @@
 #include "bsp/board.h"
 #include "tusb.h"
 #include "usb_descriptors.h"
+#include "analog.h"
+#include "debounce.h"
+#include "trial.h"
+#include "marker.h"
+#include "health.h"
+#include "sync.h"
+#include "capture.h"
+#include "quadrature.h"
 
 #define HZ 100  //digital input sampling delay in us.
 #define NCHAN 8 //max number of input/output channels = 8
 #define FIRST_GPIO_IN 0
 #define FIRST_GPIO_OUT (FIRST_GPIO_IN + 8)
-#define RANGE_GPIO 0xFFFF
+#define NEVENT (NCHAN + (VOICEKEY ? VOICEKEY_ONSET_BIT + 1 : ANALOG_NCHAN)) //number of event channels: digital inputs followed by force onsets and the voice key
+#define RANGE_GPIO 0xFF
 #define KEY_JOY_SEL_PIN 18
 #define KEY_MODE_SEL_PIN 19
 #define DEBOUNCE_SEL_PIN 20
 #define INVERT_OUTPUTS_SEL_PIN 21
+#define EVENT_QUEUE_LEN 64 //events buffered while the USB is busy or suspended
+#ifndef CHORD_WINDOW
+#define CHORD_WINDOW 0 //chord detection window in us, 0 = off
+#endif
 
 //--------------------------------------------------------------------+
 // MACRO CONSTANT TYPEDEF PROTYPES
@@ -86,7 +99,9 @@ enum {
 // prototypes
 void led_blinking_task(void);
 void hid_task(void);
-static void send_hid_report(uint8_t report_id);
+static void send_hid_report(uint8_t instance);
+static void send_event_report(void);
+static bool queue_event(uint32_t state, uint32_t mask, uint32_t time, uint8_t flags);
 bool timer_callback(repeating_timer_t *rt);
 void to_hex(uint8_t* in, uint8_t* out);
 void to_keycode(uint8_t* in, size_t insz, uint8_t* out);
@@ -94,8 +109,26 @@ void to_keycode(uint8_t* in, size_t insz, uint8_t* out);
 // globals
 static uint32_t blink_interval_ms = BLINK_NOT_MOUNTED;
 static uint32_t portsAll;
-static uint8_t newEvent, lastEvent, xMask;
-static bool eventUpdate;
+static uint32_t newEvent, lastEvent, lastScan, xMask;
+static bool eventUpdate, eventRecord;
+typedef struct {
+  uint32_t state;  // event channel states
+  uint32_t mask;   // changed channels
+  uint32_t time;   // device time of the input scan, in us
+  uint16_t seq;
+  uint8_t flags;
+} ezEvent;
+static queue_t eventQueue;
+static ezEvent event; // event being reported
+static bool has_keyboard_key; // hex key pressed, release report pending
+static uint16_t eventSeq;
+static volatile uint8_t eventFlags;
+static volatile bool busSuspended;
+static bool wakeupPending;
+static uint32_t wakeupTime;
+static ez_timing_report_t timing;
+static volatile uint32_t chordTicks = CHORD_WINDOW / HZ; // chord window in scan periods
+static uint32_t chordLeft, chordTime, chordPressed;
 typedef struct {
   bool ncContacts;
   bool deviceMode;
@@ -105,41 +138,35 @@ typedef struct {
 } ezConfig;
 ezConfig config;
 
+// Keyboard mode-I key per event channel
+static const uint8_t keymap[NCHAN + 4] =
+{
+  HID_KEY_1, HID_KEY_2, HID_KEY_3, HID_KEY_4, HID_KEY_5, HID_KEY_6, HID_KEY_7, HID_KEY_8, // GP0-GP7
+  HID_KEY_A, HID_KEY_B, HID_KEY_C, // force onsets GP26-GP28
+  HID_KEY_V                        // voice key
+};
+
 static uint8_t window[8] = {0, 0, 0, 0, 0, 0, 0, 0}; // store 8-ch parallel window data
-static const uint8_t filtered[32] =
+static uint8_t debounced[8] = {0, 0, 0, 0, 0, 0, 0, 0}; // debounced output per channel
+
+// Debounce decision tables, generated at compile time from the filter spec per channel.
+static const uint8_t filterCh0[DEBOUNCE_TABLE_SIZE] = DEBOUNCE_TABLE(DEBOUNCE_CH0);
+static const uint8_t filterCh1[DEBOUNCE_TABLE_SIZE] = DEBOUNCE_TABLE(DEBOUNCE_CH1);
+static const uint8_t filterCh2[DEBOUNCE_TABLE_SIZE] = DEBOUNCE_TABLE(DEBOUNCE_CH2);
+static const uint8_t filterCh3[DEBOUNCE_TABLE_SIZE] = DEBOUNCE_TABLE(DEBOUNCE_CH3);
+static const uint8_t filterCh4[DEBOUNCE_TABLE_SIZE] = DEBOUNCE_TABLE(DEBOUNCE_CH4);
+static const uint8_t filterCh5[DEBOUNCE_TABLE_SIZE] = DEBOUNCE_TABLE(DEBOUNCE_CH5);
+static const uint8_t filterCh6[DEBOUNCE_TABLE_SIZE] = DEBOUNCE_TABLE(DEBOUNCE_CH6);
+static const uint8_t filterCh7[DEBOUNCE_TABLE_SIZE] = DEBOUNCE_TABLE(DEBOUNCE_CH7);
+
+static const uint8_t* const filtered[8] =
 {
-  0,  //00000
-  0,  //00001
-  0,  //00010
-  1,  //00011
-  0,  //00100
-  1,  //00101
-  1,  //00110
-  1,  //00111
-  0,  //01000
-  1,  //01001
-  1,  //01010
-  1,  //01011
-  1,  //01100
-  1,  //01101
-  1,  //01110
-  1,  //01111
-  0,  //10000
-  0,  //10001
-  0,  //10010
-  1,  //10011
-  0,  //10100
-  1,  //10101
-  1,  //10110
-  1,  //10111
-  0,  //11000
-  1,  //11001
-  1,  //11010
-  1,  //11011
-  1,  //11100
-  1,  //11101
-  1,  //11110
-  1   //11111
+  filterCh0, filterCh1, filterCh2, filterCh3, filterCh4, filterCh5, filterCh6, filterCh7
+};
+static const uint8_t windowMask[8] =
+{
+  DEBOUNCE_MASK(DEBOUNCE_CH0), DEBOUNCE_MASK(DEBOUNCE_CH1), DEBOUNCE_MASK(DEBOUNCE_CH2), DEBOUNCE_MASK(DEBOUNCE_CH3),
+  DEBOUNCE_MASK(DEBOUNCE_CH4), DEBOUNCE_MASK(DEBOUNCE_CH5), DEBOUNCE_MASK(DEBOUNCE_CH6), DEBOUNCE_MASK(DEBOUNCE_CH7)
 };
 
 
@@ -172,14 +199,8 @@ int main(void)
     gpio_pull_up(gpio);
   }
 
-  for (int gpio = FIRST_GPIO_OUT; gpio < FIRST_GPIO_OUT + NCHAN; gpio++)
-  {
-    gpio_init(gpio);
-    gpio_set_dir(gpio, GPIO_OUT);
-    if(!config.invertOp) {
-      gpio_set_outover(gpio, GPIO_OVERRIDE_INVERT); //invert output channels
-    }
-  }  
+  // The output channels are driven by the PIO marker engine
+  marker_init(FIRST_GPIO_OUT, !config.invertOp); //invert output channels
 
   // Detect if one or more switches are NC and pulling down the input.
   portsAll = ~gpio_get_all(); // Read all gpio's (29-0) at once and bitwise invert.
@@ -189,8 +210,15 @@ int main(void)
     config.ncContacts = true;
   }
 
+  queue_init(&eventQueue, sizeof(ezEvent), EVENT_QUEUE_LEN);
+
   board_init();
   tusb_init();
+  analog_init();
+  quadrature_init();
+  trial_init();
+  sync_init();
+  capture_init(FIRST_GPIO_IN);
 
   repeating_timer_t timer;
   // negative timeout means exact delay in us (rather than delay between callbacks)
@@ -205,6 +233,9 @@ int main(void)
     led_blinking_task();
 
     hid_task();
+    trial_task();
+    sync_task();
+    capture_task();
     //cancel_repeating_timer(&timer);
   }
 }
@@ -219,12 +250,14 @@ int main(void)
 void tud_mount_cb(void)
 {
   blink_interval_ms = BLINK_MOUNTED;
+  wakeupPending = false;
 }
 
 // Invoked when device is unmounted
 void tud_umount_cb(void)
 {
   blink_interval_ms = BLINK_NOT_MOUNTED;
+  wakeupPending = false;
 }
 
 // Invoked when usb bus is suspended
@@ -234,12 +267,24 @@ void tud_suspend_cb(bool remote_wakeup_en)
 {
   (void) remote_wakeup_en;
   blink_interval_ms = BLINK_SUSPENDED;
+  busSuspended = true;
+  timing.suspendEvents = 0;
+  // The host may have answered a previous wakeup with a bus reset instead of a resume.
+  wakeupPending = false;
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void)
 {
   blink_interval_ms = BLINK_MOUNTED;
+  busSuspended = false;
+
+  // Resume latency of our own remote wakeup request
+  if (wakeupPending) {
+    timing.resumeLatency = time_us_32() - wakeupTime;
+    if (timing.resumeLatency > timing.resumeLatencyMax) timing.resumeLatencyMax = timing.resumeLatency;
+    wakeupPending = false;
+  }
 }
 
 
@@ -262,13 +307,44 @@ void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_
 // Return zero will cause the stack to STALL request
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen)
 {
-  // TODO not Implemented
-  (void) instance;
-  (void) report_id;
-  (void) report_type;
-  (void) buffer;
-  (void) reqlen;
+  if (instance != HID_INSTANCE_CONTROL || report_type != HID_REPORT_TYPE_FEATURE) return 0;
 
+  switch(report_id)
+  {
+    case REPORT_ID_TIMING:
+      if (reqlen < sizeof(timing)) return 0;
+      timing.now = time_us_32();
+      memcpy(buffer, &timing, sizeof(timing));
+      return sizeof(timing);
+
+    case REPORT_ID_CHORD:
+    {
+      ez_chord_report_t chord = { .window = chordTicks * HZ };
+      if (reqlen < sizeof(chord)) return 0;
+      memcpy(buffer, &chord, sizeof(chord));
+      return sizeof(chord);
+    }
+
+    case REPORT_ID_TRIAL_CONTROL:
+      return trial_get_control(buffer, reqlen);
+
+    case REPORT_ID_MARKER:
+      return marker_get_config(buffer, reqlen);
+
+    case REPORT_ID_HEALTH:
+      return health_get_report(buffer, reqlen, HZ);
+
+    case REPORT_ID_SYNC:
+      return sync_get_report(buffer, reqlen);
+
+    case REPORT_ID_CAPTURE:
+      return capture_get_report(buffer, reqlen);
+
+    case REPORT_ID_VOICEKEY:
+      return voicekey_get_report(buffer, reqlen);
+
+    default: break;
+  }
   return 0;
 }
 
@@ -277,12 +353,56 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_t
 // received data on OUT endpoint ( Report ID = 0, Type = 0 )
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize)
 {
-  (void) instance;
+  if (instance == HID_INSTANCE_CONTROL && report_type == HID_REPORT_TYPE_FEATURE)
+  {
+    switch(report_id)
+    {
+      case REPORT_ID_CHORD:
+      {
+        ez_chord_report_t chord;
+        if (bufsize < sizeof(chord)) return;
+        memcpy(&chord, buffer, sizeof(chord));
+        chordTicks = chord.window / HZ;
+      }
+      break;
+
+      case REPORT_ID_TRIAL_TABLE:
+        trial_set_table(buffer, bufsize);
+        break;
+
+      case REPORT_ID_TRIAL_CONTROL:
+        trial_set_control(buffer, bufsize);
+        break;
+
+      case REPORT_ID_MARKER:
+        marker_set_config(buffer, bufsize);
+        break;
+
+      case REPORT_ID_HEALTH:
+        health_set_report(buffer, bufsize);
+        break;
+
+      case REPORT_ID_SYNC:
+        sync_set_report(buffer, bufsize);
+        break;
+
+      case REPORT_ID_CAPTURE:
+        capture_set_report(buffer, bufsize);
+        break;
+
+      case REPORT_ID_VOICEKEY:
+        voicekey_set_report(buffer, bufsize);
+        break;
+
+      default: break;
+    }
+    return;
+  }
 
   if (report_type == HID_REPORT_TYPE_OUTPUT)
   {
     // Set keyboard LED e.g Capslock, Numlock etc...
-    if (report_id == REPORT_ID_KEYBOARD)
+    if (instance == HID_INSTANCE_KEYBOARD)
     {
       // bufsize should be (at least) 1
       if ( bufsize < 1 ) return;
@@ -332,18 +452,45 @@ void led_blinking_task(void)
 //--------------------------------------------------------------------+
 void hid_task(void)
 {
+  // Discard events from before enumeration
+  if ( !tud_mounted() ) {
+    while (queue_try_remove(&eventQueue, &event));
+    eventUpdate = false;
+    has_keyboard_key = false;
+    eventRecord = false;
+    return;
+  }
+
+  // Take the next event from the queue when the previous one is reported.
+  // Events captured during suspend keep their original timestamp.
+  // The timestamp report does not hold up the queue, the control endpoint is
+  // only polled while a host application has it opened.
+  // A hex key must be released first, or the host misses back-to-back keys.
+  if ( !eventUpdate && !has_keyboard_key && queue_try_remove(&eventQueue, &event) ) {
+    eventUpdate = true;
+    eventRecord = true;
+  }
+
   // Remote wakeup
-  if ( tud_suspended() && eventUpdate) {
+  if ( tud_suspended() ) {
     // Wake up host if we are in suspend mode
     // and REMOTE_WAKEUP feature is enabled by host
-    tud_remote_wakeup();
+    if ( eventUpdate && !wakeupPending && tud_remote_wakeup() ) {
+      wakeupPending = true;
+      wakeupTime = time_us_32();
+      timing.wakeupCount++;
+    }
   } else
   {
+    // The keyboard and gamepad have their own endpoint and can report in the same frame.
+    // In keyboard mode the gamepad only streams the analog axes.
     if(config.deviceMode == true) {
-      send_hid_report(REPORT_ID_KEYBOARD);
-    } else {
-      send_hid_report(REPORT_ID_GAMEPAD);
+      send_hid_report(HID_INSTANCE_KEYBOARD);
     }
+    send_hid_report(HID_INSTANCE_GAMEPAD);
+
+    // The timestamp follows on the control interface, once the event itself went out.
+    if ( eventRecord && !eventUpdate ) send_event_report();
   }
 }
 
@@ -352,74 +499,90 @@ void hid_task(void)
 //--------------------------------------------------------------------+
 // SEND HID REPORT
 //--------------------------------------------------------------------+
-static void send_hid_report(uint8_t report_id)
+static void send_hid_report(uint8_t instance)
 {
   // skip if hid is not ready yet
-  if ( !tud_hid_ready() ) return;
+  if ( !tud_hid_n_ready(instance) ) return;
 
 
-  switch(report_id)
+  switch(instance)
   {
-    case REPORT_ID_KEYBOARD:
+    case HID_INSTANCE_KEYBOARD:
     {
-      // use to avoid send multiple consecutive zero report for keyboard
-      static bool has_keyboard_key = false;
       uint8_t keycode[6] = { 0 };
 
       if ( eventUpdate )
       {
         if(config.keyMode == true) {
-          if(lastEvent == 0) { // input changed to zero
-            tud_hid_keyboard_report(REPORT_ID_KEYBOARD, 0, NULL);
+          if(event.state == 0) { // input changed to zero
+            tud_hid_n_keyboard_report(HID_INSTANCE_KEYBOARD, 0, 0, NULL);
           }
           else
           {
             // Handling multiple (n=6 max) changes at once.
-            // In practice, detecting a double key hit will be seldom,
-            // because of the high sampling rate. n set to 3.
+            // Without chord mode, detecting a double key hit will be seldom,
+            // because of the high sampling rate.
             uint8_t k, n=0;
-            for(k = 0; k < NCHAN; k++) {
-              if((lastEvent >> k) & (xMask >> k) & 1) {
-                keycode[n] = HID_KEY_1 + k;
+            for(k = 0; k < NEVENT; k++) {
+              if((event.state >> k) & (event.mask >> k) & 1) {
+                keycode[n] = keymap[k];
                 n++;
               }
-              if(n > 2) break;
+              if(n > 5) break;
               //keycode[0] = n + 0x1D; // for double hit debugging purpose
             }
           }
-          tud_hid_keyboard_report(REPORT_ID_KEYBOARD, 0, keycode);
-        } else { // output hex
+          tud_hid_n_keyboard_report(HID_INSTANCE_KEYBOARD, 0, 0, keycode);
+        } else if(event.mask & RANGE_GPIO) { // output hex, digital inputs only
           enum { hexsz = 2 };
           uint8_t hexcode[hexsz]; // create target array
-          to_hex(&lastEvent, hexcode);
+          uint8_t code = event.state & 0xFF; // digital inputs only
+          to_hex(&code, hexcode);
           to_keycode(hexcode, hexsz, keycode);
-          tud_hid_keyboard_report(REPORT_ID_KEYBOARD, 0, keycode);
+          tud_hid_n_keyboard_report(HID_INSTANCE_KEYBOARD, 0, 0, keycode);
           has_keyboard_key = true;
         }
       eventUpdate = false;
       }
       else {
         // send empty key report if previously has key pressed
-        if (has_keyboard_key) tud_hid_keyboard_report(REPORT_ID_KEYBOARD, 0, NULL);
+        if (has_keyboard_key) tud_hid_n_keyboard_report(HID_INSTANCE_KEYBOARD, 0, 0, NULL);
         has_keyboard_key = false;
       }
     }
     break;
 
-    case REPORT_ID_GAMEPAD:
+    case HID_INSTANCE_GAMEPAD:
     {
       hid_gamepad_report_t report = {
         .x   = 0, .y = 0, .z = 0,
         .rz = 0, .rx = 0, .ry = 0,
-        .hat = 0, 
+        .hat = 0,
         .buttons = 0
       };
 
-      if ( eventUpdate ) {
-        report.buttons = lastEvent;
-        // report.hat = 0 // completing axis data, etc.
-        tud_hid_report(REPORT_ID_GAMEPAD, &report, sizeof(report));
-        eventUpdate = false;
+      // Force levels go out on the x, y and z axes, the encoder position on the dial
+      // and its velocity on rz, at the report rate.
+      int8_t axes[3] = { 0 };
+      int16_t position = 0;
+      int8_t velocity = 0;
+      bool axesUpdate = analog_read(axes);
+      axesUpdate |= quadrature_read(&position, &velocity);
+      bool update = !config.deviceMode && eventUpdate;
+
+      if ( update || axesUpdate ) {
+        report.x = axes[0];
+        report.y = axes[1];
+        report.z = axes[2];
+        report.rz = velocity;
+        report.buttons = config.deviceMode ? 0 : event.state; // keyboard mode: axes only
+#if QUADRATURE
+        ez_gamepad_report_t dialReport = { .dial = position, .pad = report };
+        tud_hid_n_report(HID_INSTANCE_GAMEPAD, 0, &dialReport, sizeof(dialReport));
+#else
+        tud_hid_n_report(HID_INSTANCE_GAMEPAD, 0, &report, sizeof(report));
+#endif
+        if ( update ) eventUpdate = false;
       }
     }
     break;
@@ -430,6 +593,30 @@ static void send_hid_report(uint8_t report_id)
 
 
 
+//--------------------------------------------------------------------+
+// SEND EVENT TIMESTAMP
+//--------------------------------------------------------------------+
+static void send_event_report(void)
+{
+  if ( !tud_hid_n_ready(HID_INSTANCE_CONTROL) ) return;
+
+  ez_event_report_t report = {
+    .time = event.time,
+    .latency = time_us_32() - event.time,
+    .state = event.state,
+    .seq = event.seq,
+    .flags = event.flags
+  };
+
+  // The first event after a resume tells how late suspended responses arrive.
+  if ( event.flags & EVENT_FLAG_SUSPENDED ) timing.flushLatency = report.latency;
+
+  tud_hid_n_report(HID_INSTANCE_CONTROL, REPORT_ID_EVENT, &report, sizeof(report));
+  eventRecord = false;
+}
+
+
+
 //--------------------------------------------------------------------+
 // Converts a byte to a hexadecimal character string
 //
@@ -474,6 +661,36 @@ void to_keycode(uint8_t* in, size_t insz, uint8_t* out) {
 
 
 
+//--------------------------------------------------------------------+
+// Queue an event, called from the timer ISR. When the queue is full,
+// lastEvent is kept and the change is merged into the next queued event.
+//--------------------------------------------------------------------+
+static bool queue_event(uint32_t state, uint32_t mask, uint32_t time, uint8_t flags)
+{
+  ezEvent ev = {
+    .state = state,
+    .mask = mask,
+    .time = time,
+    .seq = eventSeq,
+    .flags = eventFlags | flags | (busSuspended ? EVENT_FLAG_SUSPENDED : 0)
+  };
+
+  if(queue_try_add(&eventQueue, &ev)) {
+    lastEvent = state;
+    eventSeq++;
+    eventFlags = 0;
+    if(busSuspended) timing.suspendEvents++;
+    return true;
+  }
+  if(!(eventFlags & EVENT_FLAG_MERGED)) {
+    eventFlags = EVENT_FLAG_MERGED;
+    timing.overflows++;
+  }
+  return false;
+}
+
+
+
 //--------------------------------------------------------------------+
 // HARDWARE TIMER ISR
 //--------------------------------------------------------------------+
@@ -489,29 +706,58 @@ bool timer_callback(repeating_timer_t *rt)
   portsAll = portsAll >> FIRST_GPIO_IN;
 
   if(config.debounceOn) {
-    // Debounce filter according Steven Pigeon, taken from:
-    // https://hbfs.wordpress.com/2008/08/20/debouncing-using-binary-finite-impulse-reponse-filter/
-    // window size = 5 bits. Filter delay is two timer periods.
+    // Debounce filter according Steven Pigeon, see debounce.h
+    // The window length and decision table are set per channel.
     for(int k = 0; k < NCHAN; k++) {
-      newEvent >>= 1; // Right shift the newEvents byte for new empty msb position
-      window[k] = ( (window[k] << 1) | ((portsAll >> k) & 1) ) & 0x1f; // calculate the 5 bit window
-      newEvent += 128 * filtered[window[k]]; // decide for the new event to become a one or a zero, write the newEvent msb
+      window[k] = ( (window[k] << 1) | ((portsAll >> k) & 1) ) & windowMask[k]; // shift in the new sample
+      debounced[k] = filtered[k][(debounced[k] << 8) | window[k]]; // decide for the new output, using the previous output for hysteresis
+      newEvent |= debounced[k] << k;
     }
   } else {
     newEvent = portsAll & 0xFF; // Use bitmask for 8 bits.
   }
 
-  // Do not miss any changes during the USB send.
-  // lastEvent is send out, because it does not change during the transfer.
-  if(!eventUpdate) {
-    xMask = newEvent ^ lastEvent;
-    if(xMask > 0) { // Detect any changes and put a flag. 
-      lastEvent = newEvent;
-      eventUpdate = true;
+  // Count raw and debounced transitions per channel
+  health_scan(portsAll & RANGE_GPIO, newEvent);
+
+  // Force onsets and the voice key are extra event channels, timed by the same scan as the buttons.
+  newEvent |= analog_onsets() << NCHAN;
+
+  uint32_t now = time_us_32();
+  xMask = newEvent ^ lastEvent;
+
+  // The trial engine takes the buttons that went down in this scan, with the
+  // time of this scan, whether or not the event fits in the HID queue.
+  trial_response(newEvent & ~lastScan & RANGE_GPIO, now);
+  lastScan = newEvent;
+
+  // Chord mode: a press opens a window of chordTicks scan periods. All changes
+  // within the window go out as one event, with the time of the first press.
+  // A press that is released again within the window is still reported, and
+  // its release follows as a separate event.
+  if(chordLeft > 0) {
+    chordPressed |= xMask & newEvent;
+    if(--chordLeft == 0) { // window closes
+      uint32_t released = chordPressed & ~newEvent;
+      uint32_t chordState = newEvent | released;
+      if(chordState ^ lastEvent) {
+        if(!queue_event(chordState, chordState ^ lastEvent, chordTime, EVENT_FLAG_CHORD)) {
+          chordLeft = 1; // queue full, retry at the next scan with the time of the first press
+        } else if(released) {
+          queue_event(newEvent, released, now, 0);
+        }
+      }
     }
+  } else if(chordTicks > 0 && (xMask & newEvent)) {
+    chordTime = now;
+    chordLeft = chordTicks;
+    chordPressed = xMask & newEvent;
+  } else if(xMask > 0) {
+    queue_event(newEvent, xMask, now, 0);
   }
 
-  // Route debounced events to hardware outputs. Set all GPIOs in one go.
-  gpio_put_masked(RANGE_GPIO << FIRST_GPIO_OUT, newEvent << FIRST_GPIO_OUT);
+  // Route debounced events to the hardware outputs as markers.
+  // During a trial run the outputs carry the stimulus codes.
+  marker_input(newEvent & RANGE_GPIO);
   return true; // keep repeating
 }
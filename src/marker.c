@@ -0,0 +1,261 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "hardware/clocks.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
+
+#include "tusb.h"
+#include "usb_descriptors.h"
+#include "marker.h"
+#include "marker.pio.h"
+
+/*
+ * Marker output engine. The input events are encoded to (level, duration)
+ * sequences that a PIO state machine plays on GP8-GP15. The marker timing is
+ * exact to the PIO clock and independent of the input scan period.
+ */
+
+#define MARKER_FIFO_LEN 8  // joined TX FIFO
+
+static PIO pio = pio0;
+static uint sm, offset;
+static uint8_t mode = MARKER_MODE;
+static uint32_t width = MARKER_WIDTH;
+static uint8_t code[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+static uint8_t lastState;
+static volatile bool held;
+static bool resync;  // a level was dropped, the port does not follow the inputs
+static uint8_t pending;  // presses waiting for FIFO space in CODE and STROBE mode
+static uint16_t dropped;
+
+
+
+//--------------------------------------------------------------------+
+// Encode one level of duration us for the PIO program
+//--------------------------------------------------------------------+
+static inline uint32_t marker_word(uint8_t level, uint32_t duration)
+{
+  if(duration < MARKER_MIN) duration = MARKER_MIN;
+  if(duration > 0xFFFFFF + MARKER_MIN) duration = 0xFFFFFF + MARKER_MIN;
+  return ((duration - MARKER_MIN) << 8) | level;
+}
+
+
+
+//--------------------------------------------------------------------+
+// Queue a complete sequence, or nothing when it does not fit in the FIFO
+//--------------------------------------------------------------------+
+static bool marker_push(const uint32_t* words, uint32_t n)
+{
+  if(MARKER_FIFO_LEN - pio_sm_get_tx_fifo_level(pio, sm) < n) {
+    dropped++;
+    return false;
+  }
+  for(uint32_t i = 0; i < n; i++) {
+    pio_sm_put(pio, sm, words[i]);
+  }
+  return true;
+}
+
+
+
+void marker_init(uint32_t firstGpioOut, bool invert)
+{
+  offset = pio_add_program(pio, &marker_program);
+  sm = pio_claim_unused_sm(pio, true);
+  marker_program_init(pio, sm, offset, firstGpioOut, (float) clock_get_hz(clk_sys) / MARKER_TICK_HZ);
+
+  // pio_gpio_init() resets the output override, set it again.
+  if(invert) {
+    for(uint32_t gpio = firstGpioOut; gpio < firstGpioOut + 8; gpio++) {
+      gpio_set_outover(gpio, GPIO_OVERRIDE_INVERT);
+    }
+  }
+}
+
+
+
+//--------------------------------------------------------------------+
+// Play one code marker per pending press, as far as the FIFO has space.
+// Simultaneous presses give consecutive markers, separated by one pulse
+// width. The remaining presses follow at the next scans.
+//--------------------------------------------------------------------+
+static void marker_codes(void)
+{
+  uint32_t words[3];
+  uint32_t n = mode == MARKER_STROBE ? 3 : 2;
+
+  for(int k = 0; k < 8 && pending; k++) {
+    if(!((pending >> k) & 1)) continue;
+    if(MARKER_FIFO_LEN - pio_sm_get_tx_fifo_level(pio, sm) < n) return;
+
+    if(mode == MARKER_STROBE) {
+      words[0] = marker_word(code[k] & 0x7F, MARKER_STROBE_SETUP);
+      words[1] = marker_word((code[k] & 0x7F) | 0x80, width);
+      words[2] = marker_word(0, width);
+    } else {
+      words[0] = marker_word(code[k], width);
+      words[1] = marker_word(0, width);
+    }
+    marker_push(words, n);
+    pending &= ~(1u << k);
+  }
+}
+
+
+
+//--------------------------------------------------------------------+
+// Debounced input state from the scan ISR, encoded according to the mode.
+//--------------------------------------------------------------------+
+void marker_input(uint8_t state)
+{
+  uint32_t words[MARKER_FIFO_LEN];
+  uint32_t n = 0;
+  uint8_t pressed = state & ~lastState;
+  bool changed = state != lastState;
+
+  lastState = state;
+  if(held) return;
+
+  if(mode == MARKER_CODE || mode == MARKER_STROBE) {
+    // A press of a button that is still pending merges into one marker
+    for(uint8_t again = pressed & pending; again; again &= again - 1) dropped++;
+    pending |= pressed;
+    if(pending) marker_codes();
+    return;
+  }
+
+  if(!changed && !(resync && mode == MARKER_LEVEL)) return;
+
+  switch(mode)
+  {
+    case MARKER_LEVEL:
+      words[n++] = marker_word(state, MARKER_MIN);
+      break;
+
+    case MARKER_PULSE:
+      if(!pressed) return;
+      words[n++] = marker_word(pressed, width);
+      words[n++] = marker_word(0, MARKER_MIN);
+      break;
+
+    default: break;
+  }
+  if(n > 0) {
+    bool ok = marker_push(words, n);
+    // A dropped level would stick until the next input change, retry at the next scan.
+    if(mode == MARKER_LEVEL) resync = !ok;
+  }
+}
+
+
+
+//--------------------------------------------------------------------+
+// Hold off the input markers while the port is used by someone else,
+// e.g. the trial engine.
+//--------------------------------------------------------------------+
+void marker_hold(bool hold)
+{
+  held = hold;
+  if(!hold) resync = true; // give the port back in the current input state
+}
+
+
+
+//--------------------------------------------------------------------+
+// Discard the queued markers and restart the PIO program, so the next
+// marker is played right away. The port keeps its current level.
+//--------------------------------------------------------------------+
+void marker_flush(void)
+{
+  pio_sm_set_enabled(pio, sm, false);
+  pending = 0;
+  pio_sm_clear_fifos(pio, sm);
+  pio_sm_restart(pio, sm);
+  pio_sm_exec(pio, sm, pio_encode_jmp(offset));
+  pio_sm_set_enabled(pio, sm, true);
+}
+
+
+
+//--------------------------------------------------------------------+
+// Put a level on the port until the next marker.
+// Returns false when the FIFO is full and the level is dropped.
+//--------------------------------------------------------------------+
+bool marker_level(uint8_t level)
+{
+  uint32_t w = marker_word(level, MARKER_MIN);
+  return marker_push(&w, 1);
+}
+
+
+
+//--------------------------------------------------------------------+
+// Put a single pulse of width us on the port.
+// Returns false when the FIFO is full and the pulse is dropped.
+//--------------------------------------------------------------------+
+bool marker_pulse(uint8_t level, uint32_t duration)
+{
+  uint32_t w[2] = { marker_word(level, duration), marker_word(0, MARKER_MIN) };
+  return marker_push(w, 2);
+}
+
+
+
+//--------------------------------------------------------------------+
+// Feature report
+//--------------------------------------------------------------------+
+void marker_set_config(uint8_t const* buffer, uint16_t bufsize)
+{
+  ez_marker_report_t report;
+
+  if(bufsize < sizeof(report)) return;
+  memcpy(&report, buffer, sizeof(report));
+  if(report.mode > MARKER_STROBE) return;
+
+  uint32_t irq = save_and_disable_interrupts();
+  mode = report.mode;
+  width = report.width;
+  pending = 0;
+  memcpy(code, report.code, sizeof(code));
+  restore_interrupts(irq);
+}
+
+uint16_t marker_get_config(uint8_t* buffer, uint16_t reqlen)
+{
+  ez_marker_report_t report = {
+    .mode = mode,
+    .width = width,
+    .dropped = dropped
+  };
+
+  if(reqlen < sizeof(report)) return 0;
+  memcpy(report.code, code, sizeof(code));
+  memcpy(buffer, &report, sizeof(report));
+  return sizeof(report);
+}
@@ -0,0 +1,58 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef MARKER_H_
+#define MARKER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Marker modes of the output port GP8-GP15
+enum {
+  MARKER_LEVEL = 0,   // outputs follow the debounced inputs level-for-level
+  MARKER_PULSE,       // fixed-width pulse with the buttons that went down
+  MARKER_CODE,        // fixed-width pulse with a code per button, one marker per button
+  MARKER_STROBE,      // button code on GP8-GP14, strobe on GP15 after a setup time
+};
+
+#ifndef MARKER_MODE
+#define MARKER_MODE MARKER_LEVEL
+#endif
+
+#define MARKER_TICK_HZ 1000000   // PIO timing resolution, durations are in us
+#define MARKER_WIDTH 10000       // default pulse width in us
+#define MARKER_STROBE_SETUP 100  // data setup time before the strobe in us
+#define MARKER_MIN 4             // shortest level the PIO program can play
+
+void marker_init(uint32_t firstGpioOut, bool invert);
+void marker_input(uint8_t state);
+void marker_hold(bool hold);
+void marker_flush(void);
+bool marker_level(uint8_t level);
+bool marker_pulse(uint8_t level, uint32_t duration);
+void marker_set_config(uint8_t const* buffer, uint16_t bufsize);
+uint16_t marker_get_config(uint8_t* buffer, uint16_t reqlen);
+
+#endif /* MARKER_H_ */
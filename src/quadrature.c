@@ -0,0 +1,114 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "pico/time.h"
+
+#include "quadrature.h"
+
+#if QUADRATURE
+
+#include "quadrature.pio.h"
+
+/*
+ * The edges of the encoder are counted by a PIO state machine at the full
+ * system clock, so no count is lost between the reads. The decoder program
+ * needs the jump table at offset 0 and has pio1 on its own.
+ */
+
+static PIO pio = pio1;
+static uint sm;
+static int32_t posRing[QUADRATURE_VEL_WINDOW];
+static uint32_t timeRing[QUADRATURE_VEL_WINDOW];
+static uint32_t ringIdx;
+
+
+
+void quadrature_init(void)
+{
+  for(uint32_t gpio = FIRST_GPIO_QUADRATURE; gpio < FIRST_GPIO_QUADRATURE + 2; gpio++) {
+    gpio_init(gpio);
+    gpio_pull_up(gpio); // open collector encoders
+  }
+
+  pio_add_program(pio, &quadrature_program);
+  sm = pio_claim_unused_sm(pio, true);
+  quadrature_program_init(pio, sm, FIRST_GPIO_QUADRATURE);
+}
+
+
+
+//--------------------------------------------------------------------+
+// Latest count of the state machine. The FIFO is full of older counts,
+// drain it and wait for the next push, which takes a few cycles.
+//--------------------------------------------------------------------+
+static int32_t quadrature_count(void)
+{
+  uint32_t count = 0;
+
+  for(uint n = pio_sm_get_rx_fifo_level(pio, sm) + 1; n > 0; n--) {
+    count = pio_sm_get_blocking(pio, sm);
+  }
+  return (int32_t) count;
+}
+
+
+
+//--------------------------------------------------------------------+
+// Position and velocity for the joystick report, read once per report:
+//   position = count, 16 bit, wraps around
+//   velocity = over the last QUADRATURE_VEL_WINDOW reads,
+//              in QUADRATURE_VEL_SCALE counts/s, saturated to -127..127
+// Returns true, the dial is streamed at the report rate.
+//--------------------------------------------------------------------+
+bool quadrature_read(int16_t* position, int8_t* velocity)
+{
+  int32_t pos = quadrature_count();
+  uint32_t now = time_us_32();
+
+  uint32_t oldest = (ringIdx + 1) & (QUADRATURE_VEL_WINDOW - 1);
+  int64_t vel = 0;
+  if(now != timeRing[oldest]) {
+    vel = (int64_t) (pos - posRing[oldest]) * 1000000 / (now - timeRing[oldest]) / QUADRATURE_VEL_SCALE;
+  }
+  if(vel > 127) vel = 127;
+  if(vel < -127) vel = -127;
+
+  ringIdx = oldest;
+  posRing[ringIdx] = pos;
+  timeRing[ringIdx] = now;
+
+  *position = (int16_t) pos;
+  *velocity = (int8_t) vel;
+  return true;
+}
+
+#else
+
+void quadrature_init(void) {}
+bool quadrature_read(int16_t* position, int8_t* velocity) { (void) position; (void) velocity; return false; }
+
+#endif
@@ -0,0 +1,45 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef QUADRATURE_H_
+#define QUADRATURE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Quadrature encoder (response dial) on GP16 (A) and GP17 (B).
+// 0 = disabled, 1 = enabled. Can be overridden from CMakeLists.txt.
+#ifndef QUADRATURE
+#define QUADRATURE 0
+#endif
+
+#define FIRST_GPIO_QUADRATURE 16
+#define QUADRATURE_VEL_WINDOW 16   // reads in the velocity window, power of 2
+#define QUADRATURE_VEL_SCALE 10    // velocity axis unit in counts/s
+
+void quadrature_init(void);
+bool quadrature_read(int16_t* position, int8_t* velocity);
+
+#endif /* QUADRATURE_H_ */
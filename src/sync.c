@@ -0,0 +1,242 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <math.h>
+#include <string.h>
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "pico/time.h"
+#include "pico/util/queue.h"
+
+#include "tusb.h"
+#include "usb_descriptors.h"
+#include "sync.h"
+
+/*
+ * External sync pulse input. The rising edges of a periodic lab sync signal
+ * are timestamped on the device clock. A straight line is fitted through the
+ * timestamps of the last SYNC_WINDOW pulses versus the pulse index:
+ *
+ *   device time = offset + index * period
+ *
+ * The offset and period map any device timestamp onto the shared timebase
+ * of the sync source: index = (time - offset) / period. The period absorbs
+ * the drift between the clocks. Missed pulses are detected from the gap and
+ * keep their index.
+ */
+
+static queue_t syncQueue;
+static uint64_t pulseTime[SYNC_WINDOW];  // device time in us
+static uint32_t pulseIndex[SYNC_WINDOW];
+static uint32_t head, count;
+static uint64_t bootTime[3];  // first edges, until two consistent intervals give the period
+static uint32_t bootCount;
+static uint32_t pulses, glitches;
+static ez_sync_report_t model;
+
+
+
+//--------------------------------------------------------------------+
+// GPIO ISR, timestamp the edge first
+//--------------------------------------------------------------------+
+static void sync_callback(uint gpio, uint32_t events)
+{
+  uint64_t t = time_us_64();
+  (void) gpio;
+  (void) events;
+  queue_try_add(&syncQueue, &t);
+}
+
+
+
+void sync_init(void)
+{
+  queue_init(&syncQueue, sizeof(uint64_t), SYNC_QUEUE_LEN);
+  gpio_init(SYNC_GPIO);
+  gpio_set_dir(SYNC_GPIO, GPIO_IN);
+  gpio_pull_down(SYNC_GPIO);
+  gpio_set_irq_enabled_with_callback(SYNC_GPIO, GPIO_IRQ_EDGE_RISE, true, &sync_callback);
+  // Edge timestamps must not wait for the input scan
+  irq_set_priority(IO_IRQ_BANK0, PICO_HIGHEST_IRQ_PRIORITY);
+}
+
+
+
+//--------------------------------------------------------------------+
+// Least squares fit of the pulse times versus the pulse index
+//--------------------------------------------------------------------+
+static void sync_fit(void)
+{
+  uint32_t first = (head + SYNC_WINDOW - count) % SYNC_WINDOW;
+  uint64_t t0 = pulseTime[first];  // fit relative to the oldest pulse for double precision
+  uint32_t n0 = pulseIndex[first];
+  double sn = 0, st = 0, snn = 0, snt = 0;
+
+  for(uint32_t i = 0; i < count; i++) {
+    uint32_t j = (first + i) % SYNC_WINDOW;
+    double n = (double) (pulseIndex[j] - n0);
+    double t = (double) (pulseTime[j] - t0);
+    sn += n;
+    st += t;
+    snn += n * n;
+    snt += n * t;
+  }
+
+  double den = count * snn - sn * sn;
+  if(den <= 0) return;
+  double b = (count * snt - sn * st) / den;  // period in us
+  double a = (st - b * sn) / count;          // time of index n0, relative to t0
+
+  double sr = 0, rmax = 0;
+  for(uint32_t i = 0; i < count; i++) {
+    uint32_t j = (first + i) % SYNC_WINDOW;
+    double r = (double) (pulseTime[j] - t0) - (a + b * (pulseIndex[j] - n0));
+    if(r < 0) r = -r;
+    sr += r * r;
+    if(r > rmax) rmax = r;
+  }
+
+  model.offset = (int64_t) (((double) t0 + a - b * n0) * 1000.0);
+  model.period = (uint64_t) (b * 1000000.0);
+  model.residualRms = (uint32_t) (sqrt(sr / count) * 1000.0);
+  model.residualMax = (uint32_t) (rmax * 1000.0);
+  model.valid = count >= SYNC_MIN_PULSES;
+}
+
+
+
+static void sync_add(uint64_t t, uint32_t index)
+{
+  pulseTime[head] = t;
+  pulseIndex[head] = index;
+  head = (head + 1) % SYNC_WINDOW;
+  if(count < SYNC_WINDOW) count++;
+}
+
+
+
+//--------------------------------------------------------------------+
+// Collect the first edges until two consecutive intervals agree, so a
+// spurious edge can not set a wrong period. Returns true when the
+// model is seeded with three pulses.
+//--------------------------------------------------------------------+
+static bool sync_boot(uint64_t t)
+{
+  bootTime[bootCount++] = t;
+  if(bootCount < 3) return false;
+
+  double i1 = (double) (bootTime[1] - bootTime[0]);
+  double i2 = (double) (bootTime[2] - bootTime[1]);
+  if(fabs(i2 - i1) > SYNC_TOLERANCE * i1) { // not yet periodic, drop the oldest edge
+    bootTime[0] = bootTime[1];
+    bootTime[1] = bootTime[2];
+    bootCount = 2;
+    return false;
+  }
+
+  for(uint32_t i = 0; i < 3; i++) sync_add(bootTime[i], i);
+  bootCount = 0;
+  return true;
+}
+
+
+
+//--------------------------------------------------------------------+
+// Add the new pulses to the model, called from the main loop
+//--------------------------------------------------------------------+
+void sync_task(void)
+{
+  uint64_t t;
+  bool update = false;
+
+  while(queue_try_remove(&syncQueue, &t)) {
+    if(count == 0) {
+      if(bootCount > 0 && t - bootTime[bootCount - 1] < SYNC_MIN_PERIOD) {
+        glitches++;
+        continue;
+      }
+      // The next edge in the queue is indexed with the period, fit right away
+      if(sync_boot(t)) sync_fit();
+    } else {
+      uint32_t last = (head + SYNC_WINDOW - 1) % SYNC_WINDOW;
+      if(model.period == 0) { // no period yet, can not index the edge
+        glitches++;
+        continue;
+      }
+      double periods = (double) (t - pulseTime[last]) * 1000000.0 / model.period;
+      if(periods < 0.5 || t - pulseTime[last] < SYNC_MIN_PERIOD) { // too early, not a sync pulse
+        glitches++;
+        continue;
+      }
+      sync_add(t, pulseIndex[last] + (uint32_t) (periods + 0.5));
+      update = true;
+    }
+    pulses++;
+  }
+
+  if(update) sync_fit();
+}
+
+
+
+//--------------------------------------------------------------------+
+// Clear the model, e.g. after the sync source was switched
+//--------------------------------------------------------------------+
+static void sync_reset(void)
+{
+  uint64_t t;
+
+  while(queue_try_remove(&syncQueue, &t));
+  head = count = bootCount = 0;
+  pulses = glitches = 0;
+  memset(&model, 0, sizeof(model));
+}
+
+
+
+//--------------------------------------------------------------------+
+// Feature reports. SET with SYNC_CMD_RESET clears the model,
+// GET returns the clock model.
+//--------------------------------------------------------------------+
+void sync_set_report(uint8_t const* buffer, uint16_t bufsize)
+{
+  ez_sync_report_t report;
+
+  if(bufsize < sizeof(report)) return;
+  memcpy(&report, buffer, sizeof(report));
+  if(report.command & SYNC_CMD_RESET) sync_reset();
+}
+
+uint16_t sync_get_report(uint8_t* buffer, uint16_t reqlen)
+{
+  model.now = time_us_64();
+  model.pulses = pulses;
+  model.glitches = glitches;
+  model.index = count ? pulseIndex[(head + SYNC_WINDOW - 1) % SYNC_WINDOW] : 0;
+
+  if(reqlen < sizeof(model)) return 0;
+  memcpy(buffer, &model, sizeof(model));
+  return sizeof(model);
+}
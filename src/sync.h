@@ -0,0 +1,43 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef SYNC_H_
+#define SYNC_H_
+
+#include <stdint.h>
+
+#define SYNC_GPIO 22        // external sync pulse input, rising edge
+#define SYNC_WINDOW 32      // number of recent pulses in the clock model fit
+#define SYNC_MIN_PULSES 4   // pulses needed before the model is valid
+#define SYNC_QUEUE_LEN 8
+#define SYNC_MIN_PERIOD 1000  // shortest plausible sync period in us, shorter intervals are glitches
+#define SYNC_TOLERANCE 0.01   // relative difference of the first two intervals to accept the period
+
+void sync_init(void);
+void sync_task(void);
+void sync_set_report(uint8_t const* buffer, uint16_t bufsize);
+uint16_t sync_get_report(uint8_t* buffer, uint16_t reqlen);
+
+#endif /* SYNC_H_ */
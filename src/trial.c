@@ -0,0 +1,304 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "hardware/sync.h"
+#include "pico/time.h"
+#include "pico/util/queue.h"
+
+#include "tusb.h"
+#include "usb_descriptors.h"
+#include "trial.h"
+#include "marker.h"
+
+/*
+ * Autonomous trial engine. The host uploads a trial table and starts the run.
+ * Stimulus onsets and response timeouts are driven by hardware timer alarms,
+ * responses are taken from the input scan. The PC is not in the timing loop.
+ * The stimulus code pulse is played by the PIO marker engine.
+ *
+ * A trial:  ISI -> stimulus code on GP8-GP15 -> response window -> result
+ * The next ISI starts at the response or at the timeout.
+ */
+
+static ez_trial_t table[TRIAL_MAX];
+static uint32_t uploaded[TRIAL_MAX / 32]; // bitmap of the table entries set by the host
+static uint16_t ntrials, current;
+static uint32_t pulse = TRIAL_PULSE_DEFAULT;
+static volatile uint8_t state = TRIAL_STATE_IDLE;
+static uint64_t onset;  // stimulus onset of the current trial, in us
+static uint8_t onsetFlags;
+static alarm_id_t alarm;
+static queue_t resultQueue;
+static uint16_t lost;
+static uint8_t error;
+
+static void next_trial(uint64_t now);
+static int64_t alarm_callback(alarm_id_t id, void *user_data);
+
+
+
+//--------------------------------------------------------------------+
+// Set the alarm for the next state change at an absolute time in us.
+// A time in the past is moved just ahead of now. The callback never runs
+// from within add_alarm_at(), which would recurse through next_trial().
+//--------------------------------------------------------------------+
+static void schedule(uint64_t time)
+{
+  alarm_id_t id;
+
+  do {
+    uint64_t earliest = time_us_64() + TRIAL_ALARM_LEAD;
+    if(time < earliest) time = earliest;
+    id = add_alarm_at(from_us_since_boot(time), alarm_callback, NULL, false);
+  } while(id == 0); // passed meanwhile
+
+  if(id > 0) {
+    alarm = id;
+  } else { // alarm pool exhausted, nothing would end the trial
+    error |= TRIAL_ERROR_ALARM;
+    state = TRIAL_STATE_IDLE;
+    marker_level(0);
+    marker_hold(false);
+  }
+}
+
+
+
+//--------------------------------------------------------------------+
+// Close the current trial and queue its result
+//--------------------------------------------------------------------+
+static void end_trial(uint32_t rt, uint8_t button, uint8_t flags)
+{
+  ez_trial_result_t result = {
+    .trial = current,
+    .onset = (uint32_t) onset,
+    .rt = rt,
+    .button = button,
+    .flags = flags | onsetFlags
+  };
+  if(!queue_try_add(&resultQueue, &result)) lost++;
+
+  if(pulse == 0) marker_level(0); // end of the held code
+  current++;
+}
+
+
+
+//--------------------------------------------------------------------+
+// Timer alarm: stimulus onset and response timeout
+//--------------------------------------------------------------------+
+static int64_t alarm_callback(alarm_id_t id, void *user_data)
+{
+  (void) id;
+  (void) user_data;
+  const ez_trial_t* t = &table[current];
+  bool ok;
+  alarm = 0;
+
+  switch(state)
+  {
+    case TRIAL_STATE_ISI:
+      // The FIFO is empty at the onset, the code is on the port within a few us.
+      ok = pulse > 0 ? marker_pulse(t->code, pulse) : marker_level(t->code);
+      onset = time_us_64();
+      onsetFlags = ok ? 0 : TRIAL_FLAG_MARKER;
+      state = TRIAL_STATE_RESPONSE;
+      schedule(onset + t->window);
+      break;
+
+    case TRIAL_STATE_RESPONSE:
+      end_trial(t->window, 0, TRIAL_FLAG_TIMEOUT);
+      next_trial(onset + t->window);
+      break;
+
+    default: break;
+  }
+  return 0; // the next alarm, if any, is added explicitly
+}
+
+
+
+//--------------------------------------------------------------------+
+// Schedule the stimulus onset of the next trial, or finish the run
+//--------------------------------------------------------------------+
+static void next_trial(uint64_t now)
+{
+  if(current >= ntrials) {
+    state = TRIAL_STATE_IDLE;
+    marker_hold(false);
+    return;
+  }
+  state = TRIAL_STATE_ISI;
+  schedule(now + table[current].isi);
+}
+
+
+
+//--------------------------------------------------------------------+
+// Response from the input scan. pressed holds the buttons that went down.
+// Runs in the timer IRQ, like the alarms.
+//--------------------------------------------------------------------+
+void trial_response(uint32_t pressed, uint32_t time)
+{
+  if(state != TRIAL_STATE_RESPONSE) return;
+
+  uint8_t button = pressed & table[current].valid;
+  if(!button) return;
+
+  // Ignore presses timed before the stimulus onset, the RT would underflow
+  int32_t rt = (int32_t) (time - (uint32_t) onset);
+  if(rt < 0) return;
+
+  if(alarm > 0) cancel_alarm(alarm);
+  alarm = 0;
+  end_trial((uint32_t) rt, button, 0);
+  next_trial(time_us_64());
+}
+
+
+
+void trial_init(void)
+{
+  queue_init(&resultQueue, sizeof(ez_trial_result_t), TRIAL_RESULT_QUEUE_LEN);
+}
+
+
+
+bool trial_running(void)
+{
+  return state != TRIAL_STATE_IDLE;
+}
+
+
+
+//--------------------------------------------------------------------+
+// Send the results in batches. A partial batch is sent when the run is over.
+//--------------------------------------------------------------------+
+void trial_task(void)
+{
+  uint32_t level = queue_get_level(&resultQueue);
+
+  if(level == 0) return;
+  if(level < TRIAL_RESULT_BATCH && trial_running()) return;
+  if(!tud_hid_n_ready(HID_INSTANCE_CONTROL)) return;
+
+  ez_trial_result_report_t report = { 0 };
+  while(report.count < TRIAL_RESULT_BATCH && queue_try_remove(&resultQueue, &report.result[report.count])) {
+    report.count++;
+  }
+  tud_hid_n_report(HID_INSTANCE_CONTROL, REPORT_ID_TRIAL_RESULT, &report, sizeof(report));
+}
+
+
+
+//--------------------------------------------------------------------+
+// Feature reports
+//--------------------------------------------------------------------+
+void trial_set_table(uint8_t const* buffer, uint16_t bufsize)
+{
+  ez_trial_table_report_t report;
+
+  if(trial_running() || bufsize < 3) return; // no table changes during a run
+  memset(&report, 0, sizeof(report));
+  memcpy(&report, buffer, bufsize < sizeof(report) ? bufsize : sizeof(report));
+
+  for(int i = 0; i < report.count && i < TRIAL_TABLE_CHUNK; i++) {
+    uint32_t k = report.index + i;
+    if(k >= TRIAL_MAX) break;
+    ez_trial_t* t = &report.trial[i];
+    if(t->isi < TRIAL_MIN_INTERVAL) t->isi = TRIAL_MIN_INTERVAL;
+    if(t->window < TRIAL_MIN_INTERVAL) t->window = TRIAL_MIN_INTERVAL;
+    table[k] = *t;
+    uploaded[k / 32] |= 1u << (k % 32);
+  }
+}
+
+
+
+//--------------------------------------------------------------------+
+// True when the first n trials have all been uploaded, and every code
+// pulse ends before the next stimulus onset
+//--------------------------------------------------------------------+
+static bool table_valid(uint32_t n, uint32_t width)
+{
+  for(uint32_t k = 0; k < n; k++) {
+    if(!(uploaded[k / 32] & (1u << (k % 32)))) return false;
+    if(width >= table[k].isi) return false;
+  }
+  return true;
+}
+
+void trial_set_control(uint8_t const* buffer, uint16_t bufsize)
+{
+  ez_trial_control_report_t report;
+
+  if(bufsize < sizeof(report)) return;
+  memcpy(&report, buffer, sizeof(report));
+
+  // Refuse to start on table entries that were never uploaded, or on code
+  // pulses that would overlap the next onset
+  if(report.command == TRIAL_CMD_START &&
+     !table_valid(report.ntrials < TRIAL_MAX ? report.ntrials : TRIAL_MAX, report.pulse)) return;
+
+  // Alarms and the input scan run in the timer IRQ
+  uint32_t irq = save_and_disable_interrupts();
+  if(alarm > 0) cancel_alarm(alarm);
+  alarm = 0;
+  if(trial_running()) marker_level(0);
+  state = TRIAL_STATE_IDLE;
+  marker_hold(false);
+
+  if(report.command == TRIAL_CMD_START) {
+    ntrials = report.ntrials < TRIAL_MAX ? report.ntrials : TRIAL_MAX;
+    pulse = report.pulse;
+    current = 0;
+    lost = 0;
+    error = 0;
+    ez_trial_result_t stale;
+    while(queue_try_remove(&resultQueue, &stale)); // unsent results of a previous run
+    marker_hold(true);
+    marker_flush(); // input markers still queued would delay the first onset
+    marker_level(0);
+    next_trial(time_us_64());
+  }
+  restore_interrupts(irq);
+}
+
+uint16_t trial_get_control(uint8_t* buffer, uint16_t reqlen)
+{
+  ez_trial_control_report_t report = {
+    .command = state,
+    .ntrials = ntrials,
+    .current = current,
+    .pulse = pulse,
+    .lost = lost,
+    .error = error
+  };
+
+  if(reqlen < sizeof(report)) return 0;
+  memcpy(buffer, &report, sizeof(report));
+  return sizeof(report);
+}
@@ -0,0 +1,59 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef TRIAL_H_
+#define TRIAL_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TRIAL_MAX 512              // size of the trial table
+#define TRIAL_RESULT_QUEUE_LEN 64  // results waiting to be sent to the host
+#define TRIAL_PULSE_DEFAULT 10000  // stimulus code pulse width in us
+#define TRIAL_MIN_INTERVAL 100     // shortest ISI and response window in us, one input scan
+#define TRIAL_ALARM_LEAD 10        // alarms are set at least this far ahead, in us
+
+// Commands of the trial control report
+enum {
+  TRIAL_CMD_STOP = 0,
+  TRIAL_CMD_START,
+};
+
+// Trial engine states
+enum {
+  TRIAL_STATE_IDLE = 0,
+  TRIAL_STATE_ISI,       // waiting for the stimulus onset
+  TRIAL_STATE_RESPONSE,  // response window open
+};
+
+void trial_init(void);
+void trial_task(void);
+bool trial_running(void);
+void trial_response(uint32_t pressed, uint32_t time);
+void trial_set_table(uint8_t const* buffer, uint16_t bufsize);
+void trial_set_control(uint8_t const* buffer, uint16_t bufsize);
+uint16_t trial_get_control(uint8_t* buffer, uint16_t reqlen);
+
+#endif /* TRIAL_H_ */
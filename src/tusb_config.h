@@ -95,14 +95,23 @@
 #endif
 
 //------------- CLASS -------------//
-#define CFG_TUD_HID               1
+#define CFG_TUD_HID               3   // keyboard, gamepad and control interface
+#if defined(CAPTURE) && CAPTURE
+#define CFG_TUD_CDC               1   // raw input capture stream, see capture.h
+#else
 #define CFG_TUD_CDC               0
+#endif
 #define CFG_TUD_MSC               0
 #define CFG_TUD_MIDI              0
 #define CFG_TUD_VENDOR            0
 
+// CDC FIFO size of TX and RX
+#define CFG_TUD_CDC_RX_BUFSIZE    64
+#define CFG_TUD_CDC_TX_BUFSIZE    1024
+
 // HID buffer size Should be sufficient to hold ID (if any) + Data
-#define CFG_TUD_HID_EP_BUFSIZE    16
+// ezRB: also limits the size of the feature reports on the control interface
+#define CFG_TUD_HID_EP_BUFSIZE    64
 
 #ifdef __cplusplus
  }
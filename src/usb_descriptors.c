@@ -51,6 +51,7 @@
 #include "pico/unique_id.h"
 #include "tusb.h"
 #include "usb_descriptors.h"
+#include "quadrature.h"
 
 /* A combination of interfaces must have a unique product id, since PC will save device driver after the first plug.
  * Same VID/PID with different interface e.g MSC (first), then CDC (later) will possibly cause system error on PC.
@@ -73,9 +74,17 @@ tusb_desc_device_t const desc_device =
     .bLength            = sizeof(tusb_desc_device_t),
     .bDescriptorType    = TUSB_DESC_DEVICE,
     .bcdUSB             = USB_BCD,
+#if CFG_TUD_CDC
+    // Use Interface Association Descriptor (IAD) for CDC
+    // As required by USB Specs IAD's subclass must be common class (2) and protocol must be IAD (1)
+    .bDeviceClass       = TUSB_CLASS_MISC,
+    .bDeviceSubClass    = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol    = MISC_PROTOCOL_IAD,
+#else
     .bDeviceClass       = 0x00,
     .bDeviceSubClass    = 0x00,
     .bDeviceProtocol    = 0x00,
+#endif
     .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
 
     .idVendor           = USB_VID,
@@ -100,12 +109,72 @@ uint8_t const * tud_descriptor_device_cb(void)
 // HID Report Descriptor
 //--------------------------------------------------------------------+
 
-uint8_t const desc_hid_report[] =
+// ezRB: Keyboard and gamepad each have their own interface, without report IDs.
+// Mouse and consumer control are not used.
+uint8_t const desc_hid_keyboard_report[] =
 {
-  TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD         )),
-  TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE            )),
-  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL )),
-  TUD_HID_REPORT_DESC_GAMEPAD ( HID_REPORT_ID(REPORT_ID_GAMEPAD          ))
+  TUD_HID_REPORT_DESC_KEYBOARD()
+};
+
+#if QUADRATURE
+// The gamepad leads with a 16 bit dial for the encoder position, see ez_gamepad_report_t.
+uint8_t const desc_hid_gamepad_report[] =
+{
+  TUD_HID_REPORT_DESC_GAMEPAD(
+    HID_USAGE_PAGE     ( HID_USAGE_PAGE_DESKTOP                 ) ,
+    HID_USAGE          ( HID_USAGE_DESKTOP_DIAL                 ) ,
+    HID_LOGICAL_MIN_N  ( 0x8000, 2                              ) ,
+    HID_LOGICAL_MAX_N  ( 0x7fff, 2                              ) ,
+    HID_REPORT_COUNT   ( 1                                      ) ,
+    HID_REPORT_SIZE    ( 16                                     ) ,
+    HID_INPUT          ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,
+  )
+};
+#else
+uint8_t const desc_hid_gamepad_report[] =
+{
+  TUD_HID_REPORT_DESC_GAMEPAD()
+};
+#endif
+
+// Vendor defined input and feature reports of the control interface. Byte arrays of n bytes.
+#define EZRB_REPORT_INPUT(id, n) \
+  HID_REPORT_ID     ( id                                     ) \
+  HID_USAGE         ( id                                     ) ,\
+  HID_LOGICAL_MIN   ( 0x00                                   ) ,\
+  HID_LOGICAL_MAX_N ( 0xff, 2                                ) ,\
+  HID_REPORT_SIZE   ( 8                                      ) ,\
+  HID_REPORT_COUNT  ( n                                      ) ,\
+  HID_INPUT         ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )
+
+#define EZRB_REPORT_FEATURE(id, n) \
+  HID_REPORT_ID     ( id                                     ) \
+  HID_USAGE         ( id                                     ) ,\
+  HID_LOGICAL_MIN   ( 0x00                                   ) ,\
+  HID_LOGICAL_MAX_N ( 0xff, 2                                ) ,\
+  HID_REPORT_SIZE   ( 8                                      ) ,\
+  HID_REPORT_COUNT  ( n                                      ) ,\
+  HID_FEATURE       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE )
+
+uint8_t const desc_hid_control_report[] =
+{
+  HID_USAGE_PAGE_N ( HID_USAGE_PAGE_VENDOR, 2 ),
+  HID_USAGE        ( 0x01                     ),
+  HID_COLLECTION   ( HID_COLLECTION_APPLICATION ),
+    EZRB_REPORT_INPUT   ( REPORT_ID_EVENT,  sizeof(ez_event_report_t)  ),
+    EZRB_REPORT_FEATURE ( REPORT_ID_TIMING, sizeof(ez_timing_report_t) ),
+    EZRB_REPORT_FEATURE ( REPORT_ID_TRIAL_TABLE, sizeof(ez_trial_table_report_t) ),
+    EZRB_REPORT_FEATURE ( REPORT_ID_TRIAL_CONTROL, sizeof(ez_trial_control_report_t) ),
+    EZRB_REPORT_INPUT   ( REPORT_ID_TRIAL_RESULT, sizeof(ez_trial_result_report_t) ),
+    EZRB_REPORT_FEATURE ( REPORT_ID_MARKER, sizeof(ez_marker_report_t) ),
+    EZRB_REPORT_FEATURE ( REPORT_ID_HEALTH, sizeof(ez_health_report_t) ),
+    EZRB_REPORT_FEATURE ( REPORT_ID_CHORD, sizeof(ez_chord_report_t) ),
+    EZRB_REPORT_FEATURE ( REPORT_ID_SYNC, sizeof(ez_sync_report_t) ),
+#if CFG_TUD_CDC
+    EZRB_REPORT_FEATURE ( REPORT_ID_CAPTURE, sizeof(ez_capture_report_t) ),
+#endif
+    EZRB_REPORT_FEATURE ( REPORT_ID_VOICEKEY, sizeof(ez_voicekey_report_t) ),
+  HID_COLLECTION_END
 };
 
 // Invoked when received GET HID REPORT DESCRIPTOR
@@ -113,8 +182,9 @@ uint8_t const desc_hid_report[] =
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 {
-  (void) instance;
-  return desc_hid_report;
+  if (instance == HID_INSTANCE_GAMEPAD) return desc_hid_gamepad_report;
+  if (instance == HID_INSTANCE_CONTROL) return desc_hid_control_report;
+  return desc_hid_keyboard_report;
 }
 
 //--------------------------------------------------------------------+
@@ -123,13 +193,24 @@ uint8_t const * tud_hid_descriptor_report_cb(uint8_t instance)
 
 enum
 {
-  ITF_NUM_HID,
+  ITF_NUM_HID_KEYBOARD,
+  ITF_NUM_HID_GAMEPAD,
+  ITF_NUM_HID_CONTROL,
+#if CFG_TUD_CDC
+  ITF_NUM_CDC,
+  ITF_NUM_CDC_DATA,
+#endif
   ITF_NUM_TOTAL
 };
 
-#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+#define  CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + 3*TUD_HID_DESC_LEN + CFG_TUD_CDC*TUD_CDC_DESC_LEN)
 
-#define EPNUM_HID   0x81
+#define EPNUM_HID_KEYBOARD   0x81
+#define EPNUM_HID_GAMEPAD    0x82
+#define EPNUM_HID_CONTROL    0x83
+#define EPNUM_CDC_NOTIF      0x84
+#define EPNUM_CDC_OUT        0x05
+#define EPNUM_CDC_IN         0x85
 
 uint8_t const desc_configuration[] =
 {
@@ -138,8 +219,16 @@ uint8_t const desc_configuration[] =
 
   // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
   //TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5)
-  // ezRB: Set polling interval to the minimum of 1ms
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 1)
+  // ezRB: Set polling interval to the minimum of 1ms. Both endpoints are polled every frame.
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID_KEYBOARD, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_keyboard_report), EPNUM_HID_KEYBOARD, CFG_TUD_HID_EP_BUFSIZE, 1),
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID_GAMEPAD, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_gamepad_report), EPNUM_HID_GAMEPAD, CFG_TUD_HID_EP_BUFSIZE, 1),
+  TUD_HID_DESCRIPTOR(ITF_NUM_HID_CONTROL, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_control_report), EPNUM_HID_CONTROL, CFG_TUD_HID_EP_BUFSIZE, 1),
+
+#if CFG_TUD_CDC
+  // ezRB: CDC data stream of the raw input capture
+  // Interface number, string index, EP notification address and size, EP data address (out, in) and size.
+  TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64)
+#endif
 };
 
 #if TUD_OPT_HIGH_SPEED
@@ -155,9 +244,15 @@ tusb_desc_device_qualifier_t const desc_device_qualifier =
   .bDescriptorType    = TUSB_DESC_DEVICE_QUALIFIER,
   .bcdUSB             = USB_BCD,
 
+#if CFG_TUD_CDC
+  .bDeviceClass       = TUSB_CLASS_MISC,
+  .bDeviceSubClass    = MISC_SUBCLASS_COMMON,
+  .bDeviceProtocol    = MISC_PROTOCOL_IAD,
+#else
   .bDeviceClass       = 0x00,
   .bDeviceSubClass    = 0x00,
   .bDeviceProtocol    = 0x00,
+#endif
 
   .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
   .bNumConfigurations = 0x01,
@@ -215,6 +310,7 @@ char const* string_desc_arr [] =
   "BSS-Research Support",        // 1: Manufacturer
   "ezResponseBox",               // 2: Product
   serial,                        // 3: Serials, uses the flash ID
+  "ezResponseBox Capture",       // 4: CDC Interface
 };
 
 static uint16_t _desc_str[32];
@@ -25,13 +25,183 @@
 #ifndef USB_DESCRIPTORS_H_
 #define USB_DESCRIPTORS_H_
 
+#include "tusb.h"
+
+// HID instances. Each one has its own interface and interrupt IN endpoint.
+// The keyboard and gamepad use no report IDs.
+enum
+{
+  HID_INSTANCE_KEYBOARD = 0,
+  HID_INSTANCE_GAMEPAD,
+  HID_INSTANCE_CONTROL,
+  HID_INSTANCE_COUNT
+};
+
+// Report IDs of the vendor defined control interface
 enum
 {
-  REPORT_ID_KEYBOARD = 1,
-  REPORT_ID_MOUSE,
-  REPORT_ID_CONSUMER_CONTROL,
-  REPORT_ID_GAMEPAD,
+  REPORT_ID_EVENT = 1,   // input, timestamp of every reported event
+  REPORT_ID_TIMING,      // feature, suspend and resume statistics
+  REPORT_ID_TRIAL_TABLE, // feature, upload a chunk of the trial table
+  REPORT_ID_TRIAL_CONTROL, // feature, start/stop the trial engine and read its status
+  REPORT_ID_TRIAL_RESULT,  // input, batch of trial results
+  REPORT_ID_MARKER,      // feature, marker output configuration
+  REPORT_ID_HEALTH,      // feature, contact health counters per channel
+  REPORT_ID_CHORD,       // feature, chord detection window
+  REPORT_ID_SYNC,        // feature, clock model of the external sync input
+  REPORT_ID_CAPTURE,     // feature, raw input capture control and statistics
+  REPORT_ID_VOICEKEY,    // feature, voice key threshold, hold time and levels
   REPORT_ID_COUNT
 };
 
+// Event flags
+#define EVENT_FLAG_SUSPENDED  0x01  // captured while the bus was suspended
+#define EVENT_FLAG_MERGED     0x02  // the event queue was full, changes were merged
+#define EVENT_FLAG_CHORD      0x04  // changes collected in a chord window, time is the first press
+
+typedef struct TU_ATTR_PACKED
+{
+  uint32_t time;       // device time of the input scan that detected the event, in us
+  uint32_t latency;    // time from the event until the report was queued for sending, in us
+  uint32_t state;      // event channel states
+  uint16_t seq;        // event sequence number
+  uint8_t  flags;
+} ez_event_report_t;
+
+typedef struct TU_ATTR_PACKED
+{
+  uint32_t now;               // device time when the report was read, in us
+  uint32_t wakeupCount;       // remote wakeups requested
+  uint32_t resumeLatency;     // last remote wakeup request until bus resume, in us
+  uint32_t resumeLatencyMax;
+  uint32_t flushLatency;      // last first-event-after-resume, from event until report, in us
+  uint16_t suspendEvents;     // events captured during the last suspend
+  uint16_t overflows;         // queue overflows (merged events)
+} ez_timing_report_t;
+
+typedef struct TU_ATTR_PACKED
+{
+  uint16_t window;     // chord detection window in us, 0 = off
+} ez_chord_report_t;
+
+// Trial engine
+#define TRIAL_TABLE_CHUNK   6   // trials per table report
+#define TRIAL_RESULT_BATCH  5   // results per result report
+
+typedef struct TU_ATTR_PACKED
+{
+  uint32_t isi;        // delay from the end of the previous trial until stimulus onset, in us
+  uint32_t window;     // response window from stimulus onset, in us
+  uint8_t  code;       // stimulus code on GP8-GP15
+  uint8_t  valid;      // valid response buttons GP0-GP7
+} ez_trial_t;
+
+typedef struct TU_ATTR_PACKED
+{
+  uint16_t index;      // table index of the first trial in this chunk
+  uint8_t  count;
+  ez_trial_t trial[TRIAL_TABLE_CHUNK];
+} ez_trial_table_report_t;
+
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t  command;    // set: TRIAL_CMD_x, get: TRIAL_STATE_x
+  uint16_t ntrials;    // number of trials to run
+  uint16_t current;    // get only, trial in progress
+  uint32_t pulse;      // stimulus code pulse width in us, 0 = hold for the response window
+  uint16_t lost;       // get only, results lost because the host did not read them
+  uint8_t  error;      // get only, TRIAL_ERROR_x of the last run
+} ez_trial_control_report_t;
+
+#define TRIAL_ERROR_ALARM   0x01  // no timer alarm available, the run was aborted
+
+#define TRIAL_FLAG_TIMEOUT  0x01
+#define TRIAL_FLAG_MARKER   0x02  // the stimulus code was dropped, it is not on the port
+
+typedef struct TU_ATTR_PACKED
+{
+  uint16_t trial;
+  uint32_t onset;      // device time of the stimulus onset, in us
+  uint32_t rt;         // response time from stimulus onset in us, the response window on timeout
+  uint8_t  button;     // responded buttons
+  uint8_t  flags;
+} ez_trial_result_t;
+
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t count;
+  ez_trial_result_t result[TRIAL_RESULT_BATCH];
+} ez_trial_result_report_t;
+
+// Marker output
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t  mode;       // MARKER_x
+  uint32_t width;      // pulse width in us
+  uint8_t  code[8];    // marker code per button GP0-GP7
+  uint16_t dropped;    // get only, markers dropped because the PIO FIFO was full
+} ez_marker_report_t;
+
+// Contact health
+#define HEALTH_CMD_RESET  0x01
+
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t  channel;    // input channel 0-7
+  uint8_t  command;    // set only, HEALTH_CMD_x
+  uint32_t presses;
+  uint32_t rawEdges;   // raw transitions before debouncing
+  uint32_t rejected;   // raw transitions rejected by the debounce filter
+  uint32_t bounces;    // bounce bursts
+  uint32_t bounceMean; // mean bounce burst duration in us
+  uint32_t bounceMax;  // longest bounce burst in us
+} ez_health_report_t;
+
+// Sync input clock model: device time = offset + index * period
+typedef struct TU_ATTR_PACKED
+{
+  uint64_t now;         // device time when the report was read, in us
+  int64_t  offset;      // device time of sync pulse index 0, in ns
+  uint64_t period;      // device time per sync period, in ps
+  uint32_t index;       // index of the last sync pulse
+  uint32_t pulses;      // sync pulses received
+  uint32_t glitches;    // edges rejected because they came too early
+  uint32_t residualRms; // fit residuals in ns
+  uint32_t residualMax;
+  uint8_t  valid;       // the model holds enough pulses
+  uint8_t  command;     // set only: SYNC_CMD_RESET clears the model
+} ez_sync_report_t;
+
+#define SYNC_CMD_RESET 0x01
+
+// Gamepad report with QUADRATURE enabled: the dial ahead of the standard gamepad fields
+typedef struct TU_ATTR_PACKED
+{
+  int16_t dial;              // encoder position, wraps around
+  hid_gamepad_report_t pad;
+} ez_gamepad_report_t;
+
+// Raw input capture
+typedef struct TU_ATTR_PACKED
+{
+  uint8_t  command;    // set: CAPTURE_CMD_x, get: running
+  uint32_t rate;       // sample rate in Hz, 0 = keep
+  uint64_t startTime;  // get only, device time of the first sample in us
+  uint32_t runs;       // get only, runs encoded
+  uint32_t dropped;    // get only, runs dropped because the host did not keep up
+  uint32_t sent;       // get only, words written to the CDC
+  uint16_t pending;    // get only, words waiting in the ring
+  uint32_t overruns;   // get only, sample blocks lost before they were encoded
+} ez_capture_report_t;
+
+// Voice key settings and levels
+typedef struct TU_ATTR_PACKED
+{
+  uint16_t threshold;  // onset level, RMS in ADC counts, 0 = keep
+  uint16_t hold;       // hold time in ms
+  uint16_t level;      // get only, current envelope, RMS in ADC counts
+  uint16_t peak;       // get only, highest envelope since the last get
+  uint32_t onsets;     // get only, number of voice onsets
+} ez_voicekey_report_t;
+
 #endif /* USB_DESCRIPTORS_H_ */
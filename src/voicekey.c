@@ -0,0 +1,134 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include <math.h>
+
+#include "tusb.h"
+#include "usb_descriptors.h"
+#include "voicekey.h"
+
+#if VOICEKEY
+
+/*
+ * Energy envelope onset detector. Every 1 ms block of microphone samples
+ * is DC-corrected and reduced to its mean square level, which is smoothed
+ * over the blocks. The key goes on when the envelope exceeds the threshold
+ * and goes off once it stayed below half the threshold for the hold time,
+ * so that the pauses within a word do not generate new onsets.
+ */
+
+static int32_t dc = 2048 << 8;  // DC level of the preamp, 8 fractional bits
+static int32_t envelope;        // mean square level in ADC counts^2
+static int32_t peak;            // highest envelope since the last report
+static uint32_t holdLeft;       // blocks
+static volatile bool onset;
+static volatile uint16_t threshold = VOICEKEY_THRESHOLD;
+static volatile uint16_t hold = VOICEKEY_HOLD;
+static uint32_t onsets;
+
+
+
+//--------------------------------------------------------------------+
+// Process one block of samples, called from the analog DMA ISR.
+// Samples are taken from buf[0], buf[stride], .. buf[(n-1) * stride].
+//--------------------------------------------------------------------+
+void voicekey_process(const uint16_t* buf, int n, int stride, bool detect)
+{
+  uint32_t energy = 0;
+
+  for(int i = 0; i < n; i++) {
+    int32_t x = (buf[i * stride] & 0xFFF) << 8;
+    dc += (x - dc) >> VOICEKEY_DC_SHIFT;
+    int32_t a = (x - dc) >> 8;
+    energy += a * a;
+  }
+  envelope += ((int32_t) (energy / n) - envelope) >> VOICEKEY_SMOOTH;
+
+  if(!detect) return; // DC level still settling
+  if(envelope > peak) peak = envelope;
+
+  int32_t on = (int32_t) threshold * threshold;
+  if(!onset) {
+    if(envelope > on) {
+      onset = true;
+      onsets++;
+      holdLeft = hold;
+    }
+  } else if(envelope >= on / 4) {
+    holdLeft = hold;
+  } else if(holdLeft > 0) {
+    holdLeft--;
+  } else {
+    onset = false;
+  }
+}
+
+
+
+bool voicekey_onset(void)
+{
+  return onset;
+}
+
+
+
+//--------------------------------------------------------------------+
+// Feature report
+//--------------------------------------------------------------------+
+void voicekey_set_report(uint8_t const* buffer, uint16_t bufsize)
+{
+  ez_voicekey_report_t report;
+
+  if(bufsize < sizeof(report)) return;
+  memcpy(&report, buffer, sizeof(report));
+  if(report.threshold > 0) threshold = report.threshold < 2048 ? report.threshold : 2048; // full scale, threshold^2 fits int32
+  hold = report.hold;
+}
+
+uint16_t voicekey_get_report(uint8_t* buffer, uint16_t reqlen)
+{
+  ez_voicekey_report_t report = {
+    .threshold = threshold,
+    .hold = hold,
+    .level = (uint16_t) sqrtf((float) envelope),
+    .peak = (uint16_t) sqrtf((float) peak),
+    .onsets = onsets
+  };
+
+  if(reqlen < sizeof(report)) return 0;
+  peak = 0;
+  memcpy(buffer, &report, sizeof(report));
+  return sizeof(report);
+}
+
+#else
+
+void voicekey_process(const uint16_t* buf, int n, int stride, bool detect) { (void) buf; (void) n; (void) stride; (void) detect; }
+bool voicekey_onset(void) { return false; }
+void voicekey_set_report(uint8_t const* buffer, uint16_t bufsize) { (void) buffer; (void) bufsize; }
+uint16_t voicekey_get_report(uint8_t* buffer, uint16_t reqlen) { (void) buffer; (void) reqlen; return 0; }
+
+#endif
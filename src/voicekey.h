@@ -0,0 +1,50 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2023 Martin Stokroos (ezResponseBox)
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef VOICEKEY_H_
+#define VOICEKEY_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Voice key: microphone preamp on the first ADC input after the force channels, GP26 + ANALOG_NCHAN.
+// 0 = disabled, 1 = enabled. Can be overridden from CMakeLists.txt.
+#ifndef VOICEKEY
+#define VOICEKEY 0
+#endif
+
+#define VOICEKEY_FS 16000          // ADC sample rate of all analog channels when the voice key is enabled
+#define VOICEKEY_ONSET_BIT 3       // bit of the voice key in analog_onsets(), after the three force onsets
+#define VOICEKEY_THRESHOLD 100     // default onset level, RMS in ADC counts (12-bit ADC)
+#define VOICEKEY_HOLD 100          // default hold time in ms after the level dropped below half the threshold
+#define VOICEKEY_DC_SHIFT 10       // DC removal high-pass, time constant 2^VOICEKEY_DC_SHIFT samples
+#define VOICEKEY_SMOOTH 1          // first order IIR low-pass of the block energy, alpha = 1/2^VOICEKEY_SMOOTH
+
+void voicekey_process(const uint16_t* buf, int n, int stride, bool detect);
+bool voicekey_onset(void);
+void voicekey_set_report(uint8_t const* buffer, uint16_t bufsize);
+uint16_t voicekey_get_report(uint8_t* buffer, uint16_t reqlen);
+
+#endif /* VOICEKEY_H_ */